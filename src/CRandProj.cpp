@@ -10,8 +10,14 @@
 #include <algorithm>
 #include <fstream>
 #include <complex>
+#include <limits>
 #include "spdlog/spdlog.h"
 #include "CRandProj.h"
+#include "kmer.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RP_X86_KERNELS
+#endif
 using namespace std;
 
 namespace rpns
@@ -45,9 +51,12 @@ namespace rpns
 			delete Wc;
 		if (Wpt)
 			delete Wpt;
+		if (table)
+			delete table;
 		pow2 = NULL;
 		Wc = NULL;
 		Wpt = NULL;
+		table = NULL;
 	}
 
 	CRandProj::~CRandProj()
@@ -115,6 +124,209 @@ namespace rpns
 		return false;
 	}
 
+	int CRandProj::compile(int lookup_bases)
+	{
+		if (!is_defined())
+		{
+			cerr << "Error!, hash is not defined" << endl;
+			return -1;
+		}
+		if (num_spokes > CRandProjTable::MAX_HASH_SIZE)
+		{
+			cerr << "Error!, hash size is too big: " << num_spokes << endl;
+			return -1;
+		}
+		if (lookup_bases < 1 || lookup_bases > CRandProjTable::MAX_LOOKUP_BASES)
+		{
+			cerr << "Error!, lookup bases must be in [1, " << CRandProjTable::MAX_LOOKUP_BASES << "]: " << lookup_bases << endl;
+			return -1;
+		}
+		if (table)
+			delete table;
+		table = NULL;
+		if (kmer_size > CRandProjTable::MAX_KMER_SIZE)
+		{
+			// does not fit a packed word, hash_seq falls back to kmer strings
+			spdlog::info("CRandProj: kmer_size={} is longer than {}, kmers are hashed as strings", kmer_size,
+						 CRandProjTable::MAX_KMER_SIZE);
+			return 0;
+		}
+		table = new CRandProjTable(*this, lookup_bases);
+		return 0;
+	}
+
+	CRandProjTable::CRandProjTable(const CRandProj &rp, int lookup_bases) : kmer_size(rp.kmer_size), hash_size(rp.num_spokes), lookup_bases(lookup_bases)
+	{
+		//same encoding as seq_encoding, indexed by the 2-bit code of A, C, G, T
+		static const complex<double> code_enc[4] = {complex<double>(-1, 0), complex<double>(0, -1), complex<double>(0, 1), complex<double>(1, 0)};
+		row_size = (hash_size + 7) / 8 * 8;
+		num_lookups = (kmer_size + lookup_bases - 1) / lookup_bases;
+		num_symbols = 1 << (2 * lookup_bases);
+		symbol_mask = (uint64_t)num_symbols - 1;
+		shift0 = 2 * lookup_bases * (num_lookups - 1);
+
+		// the first block is the partial one, its missing leading bases are
+		// zero bits in a packed kmer and contribute nothing
+		table.resize((size_t)num_lookups * num_symbols * row_size, 0.0);
+		int lead = num_lookups * lookup_bases - kmer_size;
+		for (int j = 0; j < num_lookups; j++)
+		{
+			for (int v = 0; v < num_symbols; v++)
+			{
+				double *row = &table[((size_t)j * num_symbols + v) * row_size];
+				for (int b = 0; b < lookup_bases; b++)
+				{
+					int pos = j * lookup_bases + b - lead;
+					if (pos < 0)
+					{
+						continue;
+					}
+					int c = (v >> (2 * (lookup_bases - 1 - b))) & 3;
+					for (int i = 0; i < hash_size; i++)
+					{
+						row[i] += (code_enc[c] * (*rp.Wpt)[pos][i]).real();
+					}
+				}
+			}
+		}
+		threshold.resize(row_size, std::numeric_limits<double>::infinity());
+		for (int i = 0; i < hash_size; i++)
+		{
+			threshold[i] = (*rp.Wc)[i].real();
+		}
+		isa = detect_isa();
+	}
+
+	CRandProjTable::Isa CRandProjTable::detect_isa()
+	{
+#ifdef RP_X86_KERNELS
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f"))
+		{
+			return ISA_AVX512;
+		}
+		if (__builtin_cpu_supports("avx2"))
+		{
+			return ISA_AVX2;
+		}
+#endif
+		return ISA_SCALAR;
+	}
+
+#ifdef RP_X86_KERNELS
+	/*
+	 * Each kernel hashes one block of kmers. For every group of 4 (AVX2) or
+	 * 8 (AVX-512) hyperplanes it keeps one accumulator per kmer and adds the
+	 * table rows lookup by lookup, i.e. in the same order as the scalar
+	 * hash, so the results are identical.
+	 */
+	__attribute__((target("avx2"))) static void hash_block_avx2(const double *table, const double *threshold,
+																 int num_lookups, int num_symbols, uint64_t symbol_mask, int shift0, int lookup_bases,
+																 int row_size, const uint64_t *kmers, uint32_t *out)
+	{
+		const int B = 8;
+		int offsets[B][CRandProjTable::MAX_KMER_SIZE];
+		for (int m = 0; m < B; m++)
+		{
+			int shift = shift0;
+			for (int j = 0; j < num_lookups; j++, shift -= 2 * lookup_bases)
+			{
+				offsets[m][j] = (j * num_symbols + (int)((kmers[m] >> shift) & symbol_mask)) * row_size;
+			}
+			out[m] = 0;
+		}
+		for (int i = 0; i < row_size; i += 4)
+		{
+			__m256d acc[B];
+			for (int m = 0; m < B; m++)
+			{
+				acc[m] = _mm256_setzero_pd();
+			}
+			for (int j = 0; j < num_lookups; j++)
+			{
+				for (int m = 0; m < B; m++)
+				{
+					acc[m] = _mm256_add_pd(acc[m], _mm256_loadu_pd(table + offsets[m][j] + i));
+				}
+			}
+			__m256d thr = _mm256_loadu_pd(threshold + i);
+			for (int m = 0; m < B; m++)
+			{
+				uint32_t bits = (uint32_t)_mm256_movemask_pd(_mm256_cmp_pd(acc[m], thr, _CMP_GT_OQ));
+				out[m] |= bits << i;
+			}
+		}
+	}
+
+	__attribute__((target("avx512f"))) static void hash_block_avx512(const double *table, const double *threshold,
+																	 int num_lookups, int num_symbols, uint64_t symbol_mask, int shift0, int lookup_bases,
+																 int row_size, const uint64_t *kmers, uint32_t *out)
+	{
+		const int B = 16;
+		int offsets[B][CRandProjTable::MAX_KMER_SIZE];
+		for (int m = 0; m < B; m++)
+		{
+			int shift = shift0;
+			for (int j = 0; j < num_lookups; j++, shift -= 2 * lookup_bases)
+			{
+				offsets[m][j] = (j * num_symbols + (int)((kmers[m] >> shift) & symbol_mask)) * row_size;
+			}
+			out[m] = 0;
+		}
+		for (int i = 0; i < row_size; i += 8)
+		{
+			__m512d acc[B];
+			for (int m = 0; m < B; m++)
+			{
+				acc[m] = _mm512_setzero_pd();
+			}
+			for (int j = 0; j < num_lookups; j++)
+			{
+				for (int m = 0; m < B; m++)
+				{
+					acc[m] = _mm512_add_pd(acc[m], _mm512_loadu_pd(table + offsets[m][j] + i));
+				}
+			}
+			__m512d thr = _mm512_loadu_pd(threshold + i);
+			for (int m = 0; m < B; m++)
+			{
+				uint32_t bits = (uint32_t)_mm512_cmp_pd_mask(acc[m], thr, _CMP_GT_OQ);
+				out[m] |= bits << i;
+			}
+		}
+	}
+#endif
+
+	void CRandProjTable::hash_batch(const uint64_t *kmers, size_t n, uint32_t *out) const
+	{
+		size_t done = 0;
+#ifdef RP_X86_KERNELS
+		if (hash_size <= 32)
+		{
+			if (isa == ISA_AVX512)
+			{
+				for (; done + 16 <= n; done += 16)
+				{
+					hash_block_avx512(table.data(), threshold.data(), num_lookups, num_symbols, symbol_mask, shift0, lookup_bases,
+									  row_size, kmers + done, out + done);
+				}
+			}
+			else if (isa == ISA_AVX2)
+			{
+				for (; done + 8 <= n; done += 8)
+				{
+					hash_block_avx2(table.data(), threshold.data(), num_lookups, num_symbols, symbol_mask, shift0, lookup_bases,
+									row_size, kmers + done, out + done);
+				}
+			}
+		}
+#endif
+		for (; done < n; done++)
+		{
+			out[done] = (uint32_t)hash(kmers[done]);
+		}
+	}
+
 	std::vector<std::complex<double>> &CRandProj::multiply(
 		const std::vector<std::complex<double>> &x,
 		const vector<vector<complex<double>>> &D,
@@ -201,6 +413,39 @@ namespace rpns
 		}
 	}
 
+	void CRandProj::hash_seq(std::string_view seq, std::vector<uint32_t> &buckets)
+	{
+		if (!table)
+		{
+			// same kmers and strands as KmerIterator, one string at a time
+			buckets.clear();
+			std::string kmer;
+			int filled = 0;
+			for (size_t i = 0; i < seq.size(); i++)
+			{
+				if (KMER_2BIT_CODE[(uint8_t)seq[i]] < 0)
+				{
+					filled = 0;
+					continue;
+				}
+				if (++filled >= kmer_size)
+				{
+					kmer.assign(seq.data() + i + 1 - kmer_size, kmer_size);
+					buckets.push_back((uint32_t)hash(canonical_kmer(kmer), false));
+				}
+			}
+			return;
+		}
+		thread_local std::vector<uint64_t> packed;
+		packed.clear();
+		for (KmerIterator it(seq, kmer_size); it.next();)
+		{
+			packed.push_back(it.canonical());
+		}
+		buckets.resize(packed.size());
+		hash_batch(packed.data(), packed.size(), buckets.data());
+	}
+
 #define READ_NUMBER(NUM, STREAM) STREAM.read((char *)&(NUM), sizeof((NUM)))
 	int CRandProj::load(const std::string &path)
 	{
@@ -244,7 +489,7 @@ namespace rpns
 		}
 		file.close();
 
-		return 0;
+		return compile();
 	}
 
 #define WRITE_NUMBER(NUM, STREAM) STREAM.write((char *)&(NUM), sizeof((NUM)))
@@ -9,8 +9,11 @@
 #define SRC_CRANDPROJ_H_
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <complex>
+#include <algorithm>
+#include <cstdint>
 #include <memory>
 #include <unordered_map>
 #include <iostream>
@@ -21,10 +24,121 @@
 namespace rpns
 {
 	class RandProjBuilder;
+	class CRandProj;
+
+	/*
+	 * Compiled form of a CRandProj for 2-bit packed kmers (A=0, C=1, G=2, T=3,
+	 * first base in the most significant bits, see KmerIterator).
+	 *
+	 * A base encodes to one of four complex numbers, so the real part of
+	 * Wpt[j][i] * enc(base) is precomputed into a kmer_size x 4 x hash_size
+	 * table and hashing becomes a gather-and-sum followed by the comparison
+	 * with Wc. The sums run in the same order as CRandProj::hash, so bucket
+	 * ids are bit-identical to hashing the kmer string.
+	 *
+	 * With lookup_bases > 1 every lookup covers a block of that many bases
+	 * (4^lookup_bases rows per block, summed at build time), which cuts the
+	 * adds per kmer by the same factor. The sums are then grouped
+	 * differently, so a projection that is within rounding error of its
+	 * threshold may fall into the other bucket.
+	 */
+	class CRandProjTable
+	{
+	public:
+		static constexpr int MAX_KMER_SIZE = 32;
+		static constexpr int MAX_HASH_SIZE = 64;
+		static constexpr int MAX_LOOKUP_BASES = 4;
+
+		enum Isa
+		{
+			ISA_SCALAR = 0,
+			ISA_AVX2 = 1,
+			ISA_AVX512 = 2
+		};
+
+		CRandProjTable(const CRandProj &rp, int lookup_bases = 1);
+
+		// projections of a kmer onto the hash_size hyperplanes
+		inline void project(uint64_t kmer, double *proj) const
+		{
+			std::fill(proj, proj + hash_size, 0.0);
+			int shift = shift0;
+			for (int j = 0; j < num_lookups; j++, shift -= 2 * lookup_bases)
+			{
+				const double *row = &table[(j * num_symbols + ((kmer >> shift) & symbol_mask)) * row_size];
+				for (int i = 0; i < hash_size; i++)
+				{
+					proj[i] += row[i];
+				}
+			}
+		}
+
+		inline unsigned long hash(uint64_t kmer) const
+		{
+			double proj[MAX_HASH_SIZE];
+			project(kmer, proj);
+			unsigned long B = 0;
+			for (int i = 0; i < hash_size; i++)
+			{
+				if (proj[i] > threshold[i])
+				{
+					B |= (1ul << i);
+				}
+			}
+			return B;
+		}
+
+		/*
+		 * Hash n packed kmers into out, same buckets as hash(). The SIMD
+		 * kernels evaluate all hyperplanes of 8 (AVX2) or 16 (AVX-512)
+		 * kmers at once. Bucket ids must fit in 32 bits.
+		 */
+		void hash_batch(const uint64_t *kmers, size_t n, uint32_t *out) const;
+
+		// best instruction set supported by this cpu
+		static Isa detect_isa();
+		// only for testing, kernels of an unsupported isa will crash
+		void set_isa(Isa isa)
+		{
+			this->isa = isa;
+		}
+		Isa get_isa() const
+		{
+			return isa;
+		}
+
+		int get_kmer_size() const
+		{
+			return kmer_size;
+		}
+		int get_hash_size() const
+		{
+			return hash_size;
+		}
+
+		int get_lookup_bases() const
+		{
+			return lookup_bases;
+		}
+
+	protected:
+		int kmer_size;
+		int hash_size;
+		int row_size; // hash_size padded to a multiple of 8
+		int lookup_bases;
+		int num_lookups; // ceil(kmer_size / lookup_bases)
+		int num_symbols; // 4^lookup_bases
+		uint64_t symbol_mask;
+		int shift0; // shift of the first (most significant) block
+		Isa isa;
+		std::vector<double> table;	   // [num_lookups][num_symbols][row_size]
+		std::vector<double> threshold; // real part of Wc, +inf in the padding
+	};
 
 	class CRandProj
 	{
 		friend class RandProjBuilder;
+		friend class CRandProjTable;
 
 	public:
 		CRandProj();
@@ -38,6 +152,21 @@ namespace rpns
 		int set_Wpt(const std::vector<double> &re, const std::vector<double> &im);
 
 		unsigned long hash(const std::string &, bool reverse_compliments);
+		// hash a 2-bit packed kmer, same bucket as hash(kmer, false). Needs compile()
+		// and kmer_size <= CRandProjTable::MAX_KMER_SIZE.
+		inline unsigned long hash_packed(uint64_t kmer) const
+		{
+			return table->hash(kmer);
+		}
+		inline void hash_batch(const uint64_t *packed_kmers, size_t n, uint32_t *out) const
+		{
+			table->hash_batch(packed_kmers, n, out);
+		}
+		// bucket ids of the canonical kmers of a sequence, kmers with a base
+		// other than A/C/G/T are skipped. Needs compile(). Kmers longer than
+		// a packed word are hashed as strings, which is much slower.
+		void hash_seq(std::string_view seq, std::vector<uint32_t> &buckets);
+		int compile(int lookup_bases = 1);
 		inline void conjugate(std::vector<std::complex<double>> &x);
 		int get_kmer_size();
 		int get_hash_size();
@@ -59,6 +188,7 @@ namespace rpns
 		int kmer_size = 0;
 		std::vector<std::complex<double>> *Wc = NULL;
 		std::vector<std::vector<std::complex<double>>> *Wpt = NULL;
+		CRandProjTable *table = NULL;
 
 		static int magic_number;
 	};
@@ -150,6 +280,7 @@ namespace rpns
 
 			rp->Wc = Wc;
 			rp->Wpt = Wpt;
+			rp->compile();
 
 			return rp;
 		};
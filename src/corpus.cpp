@@ -0,0 +1,295 @@
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "corpus.h"
+
+static const char CORPUS_MAGIC[8] = {'S', 'P', 'C', 'O', 'R', 'P', 'U', 'S'};
+
+static uint64_t align64(uint64_t x)
+{
+    return (x + 63) / 64 * 64;
+}
+
+HashedCorpus::HashedCorpus() : offsets_mem(1, 0)
+{
+    memset(&header, 0, sizeof(header));
+}
+
+HashedCorpus::HashedCorpus(size_t budget_bytes, const std::string &spill_path)
+    : offsets_mem(1, 0), budget_bytes(budget_bytes), spill_path(spill_path)
+{
+    memset(&header, 0, sizeof(header));
+}
+
+HashedCorpus::~HashedCorpus()
+{
+    release();
+}
+
+void HashedCorpus::release()
+{
+    if (spill)
+    {
+        fclose(spill);
+        spill = NULL;
+        unlink(spill_path.c_str());
+    }
+    if (map_base)
+    {
+        munmap(map_base, map_bytes);
+        map_base = NULL;
+        map_bytes = 0;
+    }
+    offsets = NULL;
+    tokens = NULL;
+    packed = NULL;
+}
+
+void HashedCorpus::start_spill()
+{
+    spill = fopen(spill_path.c_str(), "w+b");
+    if (!spill)
+    {
+        throw std::runtime_error("can not create corpus spill file: " + spill_path);
+    }
+    if (!mem.empty() && fwrite(mem.data(), sizeof(uint32_t), mem.size(), spill) != mem.size())
+    {
+        throw std::runtime_error("write corpus spill file failed: " + spill_path);
+    }
+    std::vector<uint32_t>().swap(mem);
+}
+
+void HashedCorpus::append(const uint32_t *tokens, size_t n)
+{
+    if (finished)
+    {
+        throw std::logic_error("append to a finished corpus");
+    }
+    if (!spill && (offsets_mem.back() + n) * sizeof(uint32_t) > budget_bytes)
+    {
+        start_spill();
+    }
+    if (spill)
+    {
+        if (n > 0 && fwrite(tokens, sizeof(uint32_t), n, spill) != n)
+        {
+            throw std::runtime_error("write corpus spill file failed: " + spill_path);
+        }
+    }
+    else
+    {
+        mem.insert(mem.end(), tokens, tokens + n);
+    }
+    offsets_mem.push_back(offsets_mem.back() + n);
+}
+
+void HashedCorpus::finish()
+{
+    if (finished)
+    {
+        return;
+    }
+    header.num_reads = offsets_mem.size() - 1;
+    header.num_tokens = offsets_mem.back();
+    offsets_mem.shrink_to_fit();
+    offsets = offsets_mem.data();
+    finished = true;
+    if (!spill)
+    {
+        mem.shrink_to_fit();
+        tokens = mem.data();
+        return;
+    }
+    if (fflush(spill) != 0)
+    {
+        throw std::runtime_error("write corpus spill file failed: " + spill_path);
+    }
+    size_t bytes = header.num_tokens * sizeof(uint32_t);
+    if (bytes > 0)
+    {
+        void *p = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fileno(spill), 0);
+        if (p == MAP_FAILED)
+        {
+            throw std::runtime_error(std::string("mmap corpus spill file failed: ") + strerror(errno));
+        }
+        // epochs read the reads in order
+        madvise(p, bytes, MADV_SEQUENTIAL);
+        map_base = p;
+        map_bytes = bytes;
+        tokens = (const uint32_t *)p;
+    }
+    // the mapping keeps the data alive
+    fclose(spill);
+    spill = NULL;
+    unlink(spill_path.c_str());
+}
+
+void HashedCorpus::save(const std::string &path, uint32_t kmer_size, uint32_t hash_size, uint32_t hash_block,
+                        uint64_t hash_checksum, bool bit_pack) const
+{
+    if (!finished)
+    {
+        throw std::logic_error("save an unfinished corpus");
+    }
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CORPUS_MAGIC, sizeof(h.magic));
+    h.version = VERSION;
+    h.kmer_size = kmer_size;
+    h.hash_size = hash_size;
+    h.hash_block = hash_block;
+    h.bits = bit_pack ? hash_size : 32;
+    h.hash_checksum = hash_checksum;
+    h.num_reads = num_reads();
+    h.num_tokens = num_tokens();
+    h.offsets_pos = align64(sizeof(Header));
+    h.tokens_pos = align64(h.offsets_pos + (h.num_reads + 1) * sizeof(uint64_t));
+
+    std::ofstream output(path, std::ios::binary | std::ios::trunc);
+    if (!output)
+    {
+        throw std::runtime_error("can not create corpus file: " + path);
+    }
+    const char zeros[64] = {0};
+    output.write((const char *)&h, sizeof(h));
+    output.write(zeros, h.offsets_pos - sizeof(h));
+    output.write((const char *)offsets, (h.num_reads + 1) * sizeof(uint64_t));
+    output.write(zeros, h.tokens_pos - h.offsets_pos - (h.num_reads + 1) * sizeof(uint64_t));
+
+    std::vector<uint32_t> read;
+    uint64_t acc = 0;
+    uint32_t nacc = 0;
+    for (size_t i = 0; i < h.num_reads; i++)
+    {
+        get(i, read);
+        if (!bit_pack)
+        {
+            output.write((const char *)read.data(), read.size() * sizeof(uint32_t));
+            continue;
+        }
+        for (uint32_t x : read)
+        {
+            acc |= (uint64_t)x << nacc;
+            nacc += h.bits;
+            if (nacc >= 64)
+            {
+                output.write((const char *)&acc, sizeof(acc));
+                nacc -= 64;
+                // the bits of x that did not fit
+                acc = nacc > 0 ? (uint64_t)x >> (h.bits - nacc) : 0;
+            }
+        }
+    }
+    if (nacc > 0)
+    {
+        output.write((const char *)&acc, sizeof(acc));
+    }
+    output.flush();
+    if (!output)
+    {
+        throw std::runtime_error("write corpus file failed: " + path);
+    }
+}
+
+void HashedCorpus::load(const std::string &path)
+{
+    release();
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("can not open corpus file: " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header))
+    {
+        close(fd);
+        throw std::runtime_error("not a corpus file: " + path);
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        throw std::runtime_error(std::string("mmap corpus file failed: ") + strerror(errno));
+    }
+    map_base = p;
+    map_bytes = st.st_size;
+    memcpy(&header, p, sizeof(Header));
+
+    if (memcmp(header.magic, CORPUS_MAGIC, sizeof(header.magic)) != 0)
+    {
+        release();
+        throw std::runtime_error("not a corpus file: " + path);
+    }
+    if (header.version != VERSION)
+    {
+        release();
+        throw std::runtime_error("unsupported corpus file version " + std::to_string(header.version) + ": " + path);
+    }
+    uint64_t token_bytes = header.bits == 32 ? header.num_tokens * sizeof(uint32_t)
+                                             : (header.num_tokens * header.bits + 63) / 64 * sizeof(uint64_t);
+    if ((header.bits != 32 && (header.bits == 0 || header.bits != header.hash_size)) ||
+        header.offsets_pos + (header.num_reads + 1) * sizeof(uint64_t) > header.tokens_pos ||
+        header.tokens_pos + token_bytes > map_bytes)
+    {
+        release();
+        throw std::runtime_error("corrupted corpus file: " + path);
+    }
+    offsets = (const uint64_t *)((const char *)p + header.offsets_pos);
+    if (offsets[header.num_reads] != header.num_tokens)
+    {
+        release();
+        throw std::runtime_error("corrupted corpus file: " + path);
+    }
+    bits = header.bits;
+    if (bits == 32)
+    {
+        tokens = (const uint32_t *)((const char *)p + header.tokens_pos);
+    }
+    else
+    {
+        packed = (const uint64_t *)((const char *)p + header.tokens_pos);
+    }
+    madvise(p, map_bytes, MADV_SEQUENTIAL);
+    finished = true;
+}
+
+void HashedCorpus::verify(uint32_t kmer_size, uint32_t hash_size, uint64_t hash_checksum) const
+{
+    if (header.kmer_size != kmer_size || header.hash_size != hash_size)
+    {
+        throw std::runtime_error("corpus was hashed with kmer_size=" + std::to_string(header.kmer_size) +
+                                 ", hash_size=" + std::to_string(header.hash_size) + " but the hash file has kmer_size=" +
+                                 std::to_string(kmer_size) + ", hash_size=" + std::to_string(hash_size));
+    }
+    if (header.hash_checksum != hash_checksum)
+    {
+        throw std::runtime_error("corpus was hashed with a different hash file");
+    }
+}
+
+uint64_t HashedCorpus::checksum_file(const std::string &path)
+{
+    std::ifstream input(path, std::ios::binary);
+    if (!input)
+    {
+        throw std::runtime_error("can not open file: " + path);
+    }
+    uint64_t h = 14695981039346656037ull;
+    char buf[1 << 16];
+    while (input)
+    {
+        input.read(buf, sizeof(buf));
+        std::streamsize n = input.gcount();
+        for (std::streamsize i = 0; i < n; i++)
+        {
+            h ^= (unsigned char)buf[i];
+            h *= 1099511628211ull;
+        }
+    }
+    return h;
+}
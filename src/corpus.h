@@ -0,0 +1,165 @@
+/*
+ * corpus.h
+ *
+ *  Reads kept as bucket ids, so that training epochs after the first do
+ *  not parse, generate k-mers or hash again, and the corpus file written
+ *  by prehash.
+ */
+
+#ifndef SOURCE_DIRECTORY__SRC_SPARC_CORPUS_H_
+#define SOURCE_DIRECTORY__SRC_SPARC_CORPUS_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/*
+ * One bucket id per k-mer, reads back to back, plus the offset of every
+ * read (num_reads()+1 entries).
+ *
+ * A corpus is either built with append() and finish(), or loaded from a
+ * corpus file with load(). When building, tokens are kept in RAM up to
+ * budget_bytes; past that everything is spilled to spill_path, which is
+ * mmap'ed by finish() and unlinked so nothing is left behind.
+ *
+ * The corpus file (version 1) is mmap'ed as is:
+ *   Header     see below
+ *   offsets    (num_reads+1) x uint64_t, at header.offsets_pos
+ *   tokens     at header.tokens_pos, num_tokens x uint32_t, or bit-packed
+ *              with bits=hash_size, LSB first in uint64_t words
+ * The sections are 64-byte aligned and native endian.
+ *
+ * append() is not thread safe. After finish() or load() the corpus is read
+ * only and can be shared by threads.
+ */
+class HashedCorpus
+{
+public:
+    static const uint32_t VERSION = 1;
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t kmer_size;
+        uint32_t hash_size;
+        uint32_t hash_block;
+        uint32_t bits;       // bits per token, 32 or hash_size
+        uint32_t reserved;
+        uint64_t hash_checksum; // of the hash file, see checksum_file
+        uint64_t num_reads;
+        uint64_t num_tokens;
+        uint64_t offsets_pos;
+        uint64_t tokens_pos;
+    };
+
+protected:
+    std::vector<uint32_t> mem;
+    std::vector<uint64_t> offsets_mem;
+    size_t budget_bytes = 0;
+    std::string spill_path;
+    FILE *spill = NULL;
+    bool finished = false;
+
+    // views used by the readers, into mem/offsets_mem or the mapping
+    const uint64_t *offsets = NULL;
+    const uint32_t *tokens = NULL;
+    const uint64_t *packed = NULL;
+    uint32_t bits = 32;
+    Header header;
+
+    void *map_base = NULL;
+    size_t map_bytes = 0;
+
+public:
+    HashedCorpus();
+    HashedCorpus(size_t budget_bytes, const std::string &spill_path);
+    HashedCorpus(const HashedCorpus &) = delete;
+    HashedCorpus &operator=(const HashedCorpus &) = delete;
+    virtual ~HashedCorpus();
+
+    void append(const uint32_t *tokens, size_t n);
+
+    // no more append, spilled tokens are mapped. Throws on I/O errors.
+    void finish();
+
+    /*
+     * Writes the finished corpus as a corpus file. With bit_pack the
+     * tokens take hash_size bits each instead of 32.
+     */
+    void save(const std::string &path, uint32_t kmer_size, uint32_t hash_size, uint32_t hash_block,
+              uint64_t hash_checksum, bool bit_pack) const;
+
+    // mmap a corpus file, throws if it is not a valid one
+    void load(const std::string &path);
+
+    // throws unless the loaded corpus was hashed with this hash
+    void verify(uint32_t kmer_size, uint32_t hash_size, uint64_t hash_checksum) const;
+
+    // FNV-1a of the file content, identifies the hash file a corpus used
+    static uint64_t checksum_file(const std::string &path);
+
+    bool is_finished() const
+    {
+        return finished;
+    }
+
+    bool is_spilled() const
+    {
+        return map_base != NULL || spill != NULL;
+    }
+
+    // kmer_size, hash_size, ... are only set for a loaded corpus
+    const Header &get_header() const
+    {
+        return header;
+    }
+
+    size_t num_reads() const
+    {
+        return finished ? header.num_reads : offsets_mem.size() - 1;
+    }
+
+    size_t num_tokens() const
+    {
+        return finished ? header.num_tokens : offsets_mem.back();
+    }
+
+    inline size_t length(size_t read) const
+    {
+        return offsets[read + 1] - offsets[read];
+    }
+
+    // the bucket ids of one read
+    inline void get(size_t read, std::vector<uint32_t> &out) const
+    {
+        uint64_t begin = offsets[read], end = offsets[read + 1];
+        out.resize(end - begin);
+        if (!packed)
+        {
+            std::copy(tokens + begin, tokens + end, out.begin());
+            return;
+        }
+        const uint64_t mask = (1ull << bits) - 1;
+        for (uint64_t i = begin; i < end; i++)
+        {
+            uint64_t pos = i * bits;
+            uint64_t word = pos >> 6;
+            uint32_t shift = pos & 63;
+            uint64_t x = packed[word] >> shift;
+            if (shift + bits > 64)
+            {
+                x |= packed[word + 1] << (64 - shift);
+            }
+            out[i - begin] = (uint32_t)(x & mask);
+        }
+    }
+
+protected:
+    void start_spill();
+    void release();
+};
+
+#endif /* SOURCE_DIRECTORY__SRC_SPARC_CORPUS_H_ */
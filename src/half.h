@@ -0,0 +1,230 @@
+/*
+ * half.h
+ *
+ *  16-bit storage types for the embedding rows (bfloat16 and IEEE half).
+ *  Values are only stored in them, all arithmetic is done in float.
+ */
+
+#ifndef SOURCE_DIRECTORY__SRC_SPARC_HALF_H_
+#define SOURCE_DIRECTORY__SRC_SPARC_HALF_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "utils.h"
+
+namespace halfops
+{
+    inline uint32_t float_bits(float x)
+    {
+        uint32_t u;
+        memcpy(&u, &x, sizeof(u));
+        return u;
+    }
+
+    inline float bits_float(uint32_t u)
+    {
+        float x;
+        memcpy(&x, &u, sizeof(x));
+        return x;
+    }
+
+    /*
+     * Random bits for stochastic rounding, a xorshift32 per thread seeded
+     * from the thread's myrand generator. The low 16 bits are used.
+     */
+    inline uint32_t rounding_bits()
+    {
+        thread_local uint32_t s = 0;
+        if (s == 0)
+        {
+            s = (uint32_t)(sparc::myrand::thread_rng()() >> 32) | 1;
+        }
+        s ^= s << 13;
+        s ^= s >> 17;
+        s ^= s << 5;
+        return s;
+    }
+} // namespace halfops
+
+/*
+ * bfloat16: the upper half of a float. Conversion from float rounds to
+ * nearest even, or stochastically: up with a probability equal to the
+ * dropped fraction, so that many small updates add up to the right value
+ * on average instead of being rounded away.
+ */
+struct bf16_t
+{
+    uint16_t bits;
+
+    bf16_t() = default;
+
+    bf16_t(float x) : bits(from_float(x))
+    {
+    }
+
+    operator float() const
+    {
+        return to_float(bits);
+    }
+
+    static const char *name()
+    {
+        return "bf16";
+    }
+
+    static inline float to_float(uint16_t h)
+    {
+        return halfops::bits_float((uint32_t)h << 16);
+    }
+
+    static inline uint16_t from_float(float x)
+    {
+        uint32_t u = halfops::float_bits(x);
+        if ((u & 0x7fffffff) > 0x7f800000)
+        {
+            return (uint16_t)((u >> 16) | 0x40); // quiet NaN
+        }
+        return (uint16_t)((u + 0x7fff + ((u >> 16) & 1)) >> 16);
+    }
+
+    // rounds up if the dropped 16 bits are larger than the 16 random bits
+    static inline uint16_t from_float(float x, uint32_t random)
+    {
+        uint32_t u = halfops::float_bits(x);
+        if ((u & 0x7fffffff) >= 0x7f7f0000)
+        {
+            return from_float(x); // NaN, inf or the largest finite values
+        }
+        return (uint16_t)((u + (random & 0xffff)) >> 16);
+    }
+};
+
+/*
+ * IEEE 754 binary16, with the same two roundings as bf16_t. It keeps 3
+ * more bits of mantissa than bfloat16, but only covers about 6e-8 to 65504.
+ * Larger values become infinite when rounded to nearest and 65504 when
+ * rounded stochastically.
+ */
+struct fp16_t
+{
+    uint16_t bits;
+
+    fp16_t() = default;
+
+    fp16_t(float x) : bits(from_float(x))
+    {
+    }
+
+    operator float() const
+    {
+        return to_float(bits);
+    }
+
+    static const char *name()
+    {
+        return "fp16";
+    }
+
+    static inline float to_float(uint16_t h)
+    {
+        uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+        uint32_t em = h & 0x7fff;
+        if (em >= 0x7c00)
+        {
+            return halfops::bits_float(sign | 0x7f800000 | ((em & 0x3ff) << 13));
+        }
+        if (em >= 0x400)
+        {
+            return halfops::bits_float(sign | ((em << 13) + ((127 - 15) << 23)));
+        }
+        float x = em * 0x1.0p-24f; // subnormal
+        return halfops::bits_float(sign | halfops::float_bits(x));
+    }
+
+    static inline uint16_t from_float(float x)
+    {
+        return convert(x, false, 0);
+    }
+
+    static inline uint16_t from_float(float x, uint32_t random)
+    {
+        return convert(x, true, random);
+    }
+
+protected:
+    static inline uint16_t convert(float x, bool stochastic, uint32_t random)
+    {
+        uint32_t u = halfops::float_bits(x);
+        uint16_t sign = (uint16_t)((u >> 16) & 0x8000);
+        u &= 0x7fffffff;
+        if (u > 0x7f800000)
+        {
+            return sign | 0x7e00; // NaN
+        }
+        if (stochastic && u >= 0x477fe000 && u < 0x7f800000)
+        {
+            return sign | 0x7bff; // an update never makes a value infinite
+        }
+        if (u >= 0x47800000)
+        {
+            return sign | 0x7c00; // too large
+        }
+        if (u < 0x38800000)
+        {
+            // subnormal, in units of 2^-24
+            float v = halfops::bits_float(u) * 0x1.0p24f;
+            uint32_t i = (uint32_t)v;
+            float frac = v - i;
+            if (stochastic ? frac * 65536.0f > (random & 0xffff) : (frac > 0.5f || (frac == 0.5f && (i & 1))))
+            {
+                i++;
+            }
+            return sign | (uint16_t)i;
+        }
+        uint32_t h = ((u >> 13) - ((127 - 15) << 10));
+        uint32_t rem = u & 0x1fff;
+        if (stochastic ? rem > (random & 0x1fff) : (rem > 0x1000 || (rem == 0x1000 && (h & 1))))
+        {
+            h++; // may carry into the exponent, up to infinity
+        }
+        return sign | (uint16_t)h;
+    }
+};
+
+// the value types an embedding table can be stored or exported in
+enum class ValueType
+{
+    FP32 = 0,
+    BF16 = 1,
+    FP16 = 2
+};
+
+inline const char *value_type_name(ValueType type)
+{
+    switch (type)
+    {
+    case ValueType::BF16:
+        return "bf16";
+    case ValueType::FP16:
+        return "fp16";
+    default:
+        return "fp32";
+    }
+}
+
+// "fp32", "bf16" or "fp16". Returns false for anything else.
+inline bool parse_value_type(const std::string &name, ValueType &type)
+{
+    for (ValueType t : {ValueType::FP32, ValueType::BF16, ValueType::FP16})
+    {
+        if (name == value_type_name(t))
+        {
+            type = t;
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif /* SOURCE_DIRECTORY__SRC_SPARC_HALF_H_ */
@@ -78,6 +78,11 @@ int main(int argc, char **argv)
          "number of bits of hash",
          1},
 
+        {"seed", {
+                     "--seed",
+                 },
+         "random seed (default from std::random_device)",
+         1},
         {"n_thread", {
                          "--thread",
                      },
@@ -115,6 +120,15 @@ int main(int argc, char **argv)
     uint32_t n_thread = args["n_thread"].as<uint32_t>(0);
     uint32_t kmer_size = args["kmer_size"].as<uint32_t>();
     uint32_t hash_size = args["hash_size"].as<uint32_t>();
+    if (kmer_size < 1)
+    {
+        std::cerr << "kmer size must be at least 1" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (args["seed"])
+    {
+        sparc::myrand::seed(args["seed"].as<uint64_t>());
+    }
     std::string input_file = args["input"].as<std::string>();
     std::string output_file = args["output"].as<std::string>("rp.bin");
     bool is_fasta = args["use_fasta"];
@@ -0,0 +1,204 @@
+/*
+ * huffman.h
+ *
+ *  Huffman tree over the bucket counts for the hierarchical softmax
+ *  output layer.
+ */
+
+#ifndef SOURCE_DIRECTORY__SRC_SPARC_HUFFMAN_H_
+#define SOURCE_DIRECTORY__SRC_SPARC_HUFFMAN_H_
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+/*
+ * Only the buckets with a positive count are leaves, so the cost of a
+ * label is about log2 of the buckets actually seen, and frequent buckets
+ * get the shortest paths. The n-1 inner nodes are numbered from the root
+ * (0) down in decreasing count order: the nodes on the paths of the hot
+ * buckets are the first rows of whatever matrix holds them.
+ *
+ * The paths of all leaves are stored one after another, every step as
+ * node << 1 | code, from the root to the leaf.
+ */
+class HuffmanTree
+{
+public:
+    static constexpr uint32_t NO_LEAF = UINT32_MAX;
+
+    // the steps of one path, valid as long as the tree is not rebuilt
+    struct Path
+    {
+        const uint32_t *first = nullptr;
+        const uint32_t *last = nullptr;
+
+        const uint32_t *begin() const
+        {
+            return first;
+        }
+        const uint32_t *end() const
+        {
+            return last;
+        }
+        size_t size() const
+        {
+            return last - first;
+        }
+        bool empty() const
+        {
+            return first == last;
+        }
+    };
+
+protected:
+    std::vector<uint32_t> leaf_of; // by bucket, NO_LEAF if never counted
+    std::vector<uint64_t> offset;  // by leaf, the first step of its path
+    std::vector<uint32_t> steps;
+    double mean_depth_ = 0;
+
+public:
+    bool empty() const
+    {
+        return offset.empty();
+    }
+
+    uint32_t num_leaves() const
+    {
+        return empty() ? 0 : (uint32_t)(offset.size() - 1);
+    }
+
+    uint32_t num_nodes() const
+    {
+        return empty() ? 0 : num_leaves() - 1;
+    }
+
+    // path length averaged over the counted tokens
+    double mean_depth() const
+    {
+        return mean_depth_;
+    }
+
+    static inline uint32_t node(uint32_t step)
+    {
+        return step >> 1;
+    }
+
+    static inline bool code(uint32_t step)
+    {
+        return step & 1;
+    }
+
+    void clear()
+    {
+        leaf_of.clear();
+        offset.clear();
+        steps.clear();
+        mean_depth_ = 0;
+    }
+
+    /*
+     * counts[i] is the count of bucket i. Returns false and stays empty if
+     * fewer than two buckets were seen, since then there is nothing to
+     * decide.
+     */
+    bool build(const std::vector<uint32_t> &counts)
+    {
+        clear();
+        std::vector<uint32_t> words;
+        for (size_t i = 0; i < counts.size(); i++)
+        {
+            if (counts[i] > 0)
+            {
+                words.push_back((uint32_t)i);
+            }
+        }
+        size_t n = words.size();
+        if (n < 2 || n > (1u << 31))
+        {
+            return false;
+        }
+        // by decreasing count, ties by bucket so every rank builds the same tree
+        std::sort(words.begin(), words.end(), [&counts](uint32_t a, uint32_t b)
+                  { return counts[a] != counts[b] ? counts[a] > counts[b] : a < b; });
+
+        // word2vec's construction: leaves [0, n) are sorted, so the two
+        // smallest are always at the end of the leaves or the front of the
+        // inner nodes [n, 2n-1), which are created in increasing count.
+        std::vector<uint64_t> weight(2 * n - 1);
+        std::vector<uint32_t> parent(2 * n - 2);
+        std::vector<uint8_t> bit(2 * n - 2, 0);
+        for (size_t i = 0; i < n; i++)
+        {
+            weight[i] = counts[words[i]];
+        }
+        int64_t leaf = (int64_t)n - 1;
+        size_t inner = n;
+        for (size_t a = n; a < 2 * n - 1; a++)
+        {
+            size_t pick[2];
+            for (size_t &p : pick)
+            {
+                if (leaf >= 0 && (inner >= a || weight[leaf] < weight[inner]))
+                {
+                    p = (size_t)leaf--;
+                }
+                else
+                {
+                    p = inner++;
+                }
+            }
+            weight[a] = weight[pick[0]] + weight[pick[1]];
+            parent[pick[0]] = (uint32_t)a;
+            parent[pick[1]] = (uint32_t)a;
+            bit[pick[1]] = 1;
+        }
+
+        // inner node a is node 2n-2-a, the root is 0
+        std::vector<uint32_t> depth(n, 0);
+        uint64_t total_steps = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            for (size_t k = i; k != 2 * n - 2; k = parent[k])
+            {
+                depth[i]++;
+            }
+            total_steps += depth[i];
+        }
+        leaf_of.assign(counts.size(), NO_LEAF);
+        offset.resize(n + 1);
+        steps.resize(total_steps);
+        uint64_t pos = 0;
+        double weighted = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            leaf_of[words[i]] = (uint32_t)i;
+            offset[i] = pos;
+            pos += depth[i];
+            uint64_t s = pos;
+            for (size_t k = i; k != 2 * n - 2; k = parent[k])
+            {
+                steps[--s] = (uint32_t)(2 * n - 2 - parent[k]) << 1 | bit[k];
+            }
+            weighted += (double)depth[i] * weight[i];
+        }
+        offset[n] = pos;
+        mean_depth_ = weighted / weight[2 * n - 2];
+        return true;
+    }
+
+    // empty for buckets that were not counted
+    inline Path path(uint32_t word) const
+    {
+        Path p;
+        uint32_t leaf = word < leaf_of.size() ? leaf_of[word] : NO_LEAF;
+        if (leaf != NO_LEAF)
+        {
+            p.first = steps.data() + offset[leaf];
+            p.last = steps.data() + offset[leaf + 1];
+        }
+        return p;
+    }
+};
+
+#endif /* SOURCE_DIRECTORY__SRC_SPARC_HUFFMAN_H_ */
@@ -6,6 +6,7 @@
 #include <algorithm>
 #include <vector>
 #include <memory>
+#include <utility>
 #include "bitsery/bitsery.h"
 #include "bitsery/adapter/stream.h"
 #include "bitsery/traits/vector.h"
@@ -13,18 +14,12 @@
 
 #include "utils.h"
 #include "gzstream.h"
+#include "pipeline.h"
+#include "seqpack.h"
 
 inline void transform_seq(std::string &line)
 {
-    std::transform(line.begin(), line.end(), line.begin(), [](char c)
-                   {
-                       c = (char)::toupper(c);
-                       if (c != 'A' && c != 'C' && c != 'G' && c != 'T')
-                       {
-                           c = 'N';
-                       }
-                       return c;
-                   });
+    normalize_seq(&line[0], line.size());
 }
 struct FastaRecord
 {
@@ -146,7 +141,7 @@ class TextReaderBase : public ReaderBase<RECORD_TYPE>
 {
 protected:
     std::ifstream *input = 0;
-    igzstream *gzinput = 0;
+    AsyncIStream *gzinput = 0; // decompressed on its own thread
     bool is_stdin = false;
     bool is_gzip;
 
@@ -171,7 +166,12 @@ public:
         {
             if (is_gzip)
             {
-                return std::getline(*gzinput, line);
+                auto &ret = std::getline(*gzinput, line);
+                if (!ret)
+                {
+                    gzinput->rethrow_if_failed();
+                }
+                return ret;
             }
             else
             {
@@ -182,9 +182,11 @@ public:
 
     virtual void open()
     {
+        // BatchReader opens again after the constructor did
+        close();
         if (is_gzip)
         {
-            gzinput = new igzstream(this->filepath.c_str());
+            gzinput = new AsyncIStream(std::unique_ptr<std::istream>(new igzstream(this->filepath.c_str())));
         }
         else
         {
@@ -463,6 +465,90 @@ protected:
     }
 };
 
+/*
+ * Wraps a batch reader (anything with a next(batch_size) that returns an
+ * empty batch at the end), a thread reads and parses the next batches
+ * while the caller works on the current one. The batch size is the one of
+ * the first next() call.
+ */
+template <class READER>
+class PipelinedReader
+{
+public:
+    typedef decltype(std::declval<READER &>().next(0)) batch_type;
+
+protected:
+    READER reader;
+    BoundedQueue<batch_type> batches;
+    std::exception_ptr error;
+    std::thread worker;
+
+public:
+    PipelinedReader(READER &&reader, size_t depth = 4)
+        : reader(std::move(reader)), batches(depth)
+    {
+    }
+
+    PipelinedReader(const PipelinedReader &) = delete;
+    PipelinedReader &operator=(const PipelinedReader &) = delete;
+
+    virtual ~PipelinedReader()
+    {
+        batches.close();
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+    }
+
+    batch_type next(size_t batch_size)
+    {
+        if (!worker.joinable())
+        {
+            worker = std::thread([this, batch_size]
+                                 { run(batch_size); });
+        }
+        batch_type v;
+        if (!batches.pop(v) && error)
+        {
+            std::rethrow_exception(error);
+        }
+        return v;
+    }
+
+protected:
+    void run(size_t batch_size)
+    {
+        try
+        {
+            while (true)
+            {
+                batch_type v = reader.next(batch_size);
+                if (v.empty() || !batches.push(std::move(v)))
+                {
+                    break;
+                }
+            }
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        batches.close();
+    }
+};
+
+// PipelinedReader over BatchReader
+template <class BASE_READER, class RECORD>
+class PipelinedBatchReader : public PipelinedReader<BatchReader<BASE_READER, RECORD>>
+{
+public:
+    PipelinedBatchReader(const std::vector<std::string> &files, size_t depth = 4)
+        : PipelinedReader<BatchReader<BASE_READER, RECORD>>(BatchReader<BASE_READER, RECORD>(files), depth)
+    {
+    }
+};
+
 template <typename T>
 inline void read(bitsery::InputStreamAdapter &br, T &val)
 {
@@ -13,7 +13,7 @@
 #include "utils.h"
 using namespace std;
 
-#define rand01 (((double) rand() / (RAND_MAX)) )
+#define rand01 (sparc::myrand::uniform<double>())
 
 /*
  * Kmer functions
@@ -172,6 +172,34 @@ string canonical_kmer(const string &seq) {
 	return rc < seq ? rc : seq;
 }
 
+const int8_t KMER_2BIT_CODE[256] = {
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1,  0, -1,  1, -1, -1, -1,  2, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1,  3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 };
+
+static const char KMER_2BIT_BASE[] = "ACGT";
+
+void packed_to_kmer(uint64_t word, int k, string &kmer) {
+	kmer.resize(k);
+	for (int i = k - 1; i >= 0; i--) {
+		kmer[i] = KMER_2BIT_BASE[word & 3];
+		word >>= 2;
+	}
+}
+
 string reverse_complement(const string &seq) {
 	string rseq;
 	rseq.resize(seq.size());
@@ -254,7 +282,7 @@ void make_combination2(std::vector<uint32_t> &v,
 
 inline void random_choice(uint32_t *arr, int n, uint32_t *data, int m) {
 	for (int i = 0; i < m; i++)
-		data[i] = arr[rand() % n];
+		data[i] = arr[sparc::myrand::uniform_int(n)];
 }
 //assume reads has no duplicates.
 std::vector<std::pair<uint32_t, uint32_t> > generate_edges(
@@ -1,6 +1,12 @@
+#ifndef SRC_KMER_H_
+#define SRC_KMER_H_
+
 #include <vector>
 #include <string>
+#include <string_view>
 #include <map>
+#include <cstdint>
+#include <stdexcept>
 
 unsigned long kmer_to_number(const std::string &kmer);
 
@@ -34,3 +40,91 @@ std::string ulong2base64(unsigned long n);
 unsigned long base64toulong(const std::string &str);
 
 std::string kmer_to_base64(const std::string &kmer);
+
+/*
+ * 2-bit code of a base (A=0, C=1, G=2, T=3), -1 for anything else.
+ * The complement of code c is 3 - c.
+ */
+extern const int8_t KMER_2BIT_CODE[256];
+
+void packed_to_kmer(uint64_t word, int k, std::string &kmer);
+
+/*
+ * Streaming k-mer iterator.
+ *
+ * Emits every k-mer of a sequence that consists of A/C/G/T only, as a 2-bit
+ * packed word (first base in the most significant bits) together with the
+ * packed reverse complement. Both words are rolled in O(1) per base and any
+ * other character simply restarts the window, so runs of N are skipped
+ * without splitting the sequence and nothing is allocated.
+ *
+ * Packed words compare in the same order as the k-mer strings, so
+ * canonical() picks the same k-mer as canonical_kmer().
+ */
+class KmerIterator {
+public:
+	static const int MAX_K = 32;
+
+	KmerIterator(const char *seq, size_t len, int k) :
+			seq(seq), len(len), k(k) {
+		if (k < 1 || k > MAX_K) {
+			throw std::runtime_error("kmer size must be in [1, 32]");
+		}
+		mask = k == 32 ? ~0ull : (1ull << (2 * k)) - 1;
+		shift = 2 * (k - 1);
+	}
+
+	KmerIterator(const std::string &seq, int k) :
+			KmerIterator(seq.data(), seq.size(), k) {
+	}
+
+	KmerIterator(std::string_view seq, int k) :
+			KmerIterator(seq.data(), seq.size(), k) {
+	}
+
+	inline bool next() {
+		while (pos < len) {
+			int8_t c = KMER_2BIT_CODE[(uint8_t) seq[pos++]];
+			if (c < 0) {
+				filled = 0;
+				continue;
+			}
+			fwd = ((fwd << 2) | (uint64_t) c) & mask;
+			rev = (rev >> 2) | ((uint64_t) (3 - c) << shift);
+			if (++filled >= k) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	inline uint64_t forward() const {
+		return fwd;
+	}
+
+	inline uint64_t reverse() const {
+		return rev;
+	}
+
+	inline uint64_t canonical() const {
+		return rev < fwd ? rev : fwd;
+	}
+
+	//offset of the current kmer in the sequence
+	inline size_t position() const {
+		return pos - k;
+	}
+
+protected:
+	const char *seq;
+	size_t len;
+	int k;
+	size_t pos = 0;
+	int filled = 0;
+	int shift;
+	uint64_t mask;
+	uint64_t fwd = 0;
+	uint64_t rev = 0;
+};
+
+#endif /* SRC_KMER_H_ */
@@ -0,0 +1,88 @@
+/*
+ * lr_schedule.h
+ *
+ *  Learning rate schedule shared by the training threads.
+ */
+
+#ifndef SOURCE_DIRECTORY__SRC_SPARC_LR_SCHEDULE_H_
+#define SOURCE_DIRECTORY__SRC_SPARC_LR_SCHEDULE_H_
+
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+
+/*
+ * With PER_TOKEN the rate decays linearly with the number of tokens
+ * trained so far, like fastText: lr * (1 - done/total). Until the total is
+ * known (set_total, e.g. after the first epoch counted the tokens) it
+ * stays at lr. PER_EPOCH is the old step schedule,
+ * lr * (epochs - epoch) / epochs for the whole epoch.
+ *
+ * Both ramp up linearly over the first warmup tokens and never go below
+ * min_lr. Threads share the progress through a relaxed atomic counter;
+ * the rate a thread sees may miss the tokens other threads have in
+ * flight, which does not matter.
+ */
+class LearningRateSchedule
+{
+public:
+    enum Kind
+    {
+        PER_TOKEN = 0,
+        PER_EPOCH = 1
+    };
+
+protected:
+    Kind kind;
+    float lr;
+    float min_lr;
+    uint64_t warmup;
+    float epoch_lr;
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> done;
+
+public:
+    LearningRateSchedule(Kind kind, float lr, float min_lr = 0, uint64_t warmup = 0)
+        : kind(kind), lr(lr), min_lr(min_lr), warmup(warmup), epoch_lr(lr), total(0), done(0)
+    {
+    }
+
+    void start_epoch(uint32_t epoch, uint32_t epochs)
+    {
+        epoch_lr = epochs == 0 ? lr : lr * (epochs - epoch) / epochs;
+    }
+
+    // tokens over all epochs, 0 if not known yet
+    void set_total(uint64_t n)
+    {
+        total.store(n, std::memory_order_relaxed);
+    }
+
+    uint64_t get_done() const
+    {
+        return done.load(std::memory_order_relaxed);
+    }
+
+    inline void advance(uint64_t n)
+    {
+        done.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    inline float rate() const
+    {
+        uint64_t d = done.load(std::memory_order_relaxed);
+        double r = epoch_lr;
+        if (kind == PER_TOKEN)
+        {
+            uint64_t t = total.load(std::memory_order_relaxed);
+            r = t == 0 ? lr : lr * std::max(0.0, 1.0 - (double)d / t);
+        }
+        if (d < warmup)
+        {
+            r *= (double)(d + 1) / warmup;
+        }
+        return std::max((float)r, min_lr);
+    }
+};
+
+#endif /* SOURCE_DIRECTORY__SRC_SPARC_LR_SCHEDULE_H_ */
@@ -0,0 +1,390 @@
+/*
+ * matrix.h
+ *
+ *  Contiguous storage for the embedding rows of a model.
+ */
+
+#ifndef SOURCE_DIRECTORY__SRC_SPARC_MATRIX_H_
+#define SOURCE_DIRECTORY__SRC_SPARC_MATRIX_H_
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <iomanip>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+#include "io.h"
+#include "half.h"
+#include "vecops.h"
+
+// 16-bit values are serialized as their bits
+inline void write(bitsery::OutputStreamAdapter &bw, bf16_t val)
+{
+    write(bw, val.bits);
+}
+
+inline void read(bitsery::InputStreamAdapter &br, bf16_t &val)
+{
+    read(br, val.bits);
+}
+
+inline void write(bitsery::OutputStreamAdapter &bw, fp16_t val)
+{
+    write(bw, val.bits);
+}
+
+inline void read(bitsery::InputStreamAdapter &br, fp16_t &val)
+{
+    read(br, val.bits);
+}
+
+/*
+ * A .vec.bin with 16-bit values starts with this, then the ValueType as
+ * uint32_t, the number of rows and dim as size_t, and the rows one after
+ * another. A fp32 .vec.bin starts with the number of rows, which is never
+ * this large.
+ */
+static const size_t VEC_BIN_HALF_MAGIC = 0x3631434556435053ull; // "SPCVEC16"
+
+/*
+ * Non-owning view of one row (pointer + dim). It is only valid as long as
+ * the matrix it came from is alive and not reallocated.
+ */
+template <typename VALUE_TYPE>
+class VectorView
+{
+    VALUE_TYPE *ptr;
+    uint32_t dim;
+
+public:
+    VectorView(VALUE_TYPE *ptr, uint32_t dim) : ptr(ptr), dim(dim)
+    {
+    }
+
+    VALUE_TYPE *data() const
+    {
+        return ptr;
+    }
+
+    uint32_t get_dim() const
+    {
+        return dim;
+    }
+
+    VALUE_TYPE &operator[](size_t i) const
+    {
+        return ptr[i];
+    }
+
+    // x may be float for 16-bit rows
+    template <typename X>
+    void add(const X *x, float alpha) const
+    {
+        vecops::axpy(alpha, x, ptr, dim);
+    }
+
+    void fill(VALUE_TYPE x) const
+    {
+        for (uint32_t i = 0; i < dim; i++)
+        {
+            ptr[i] = x;
+        }
+    }
+
+    void randomize() const
+    {
+        for (uint32_t i = 0; i < dim; i++)
+        {
+            ptr[i] = sparc::myrand::uniform<VALUE_TYPE>() * 2 - 1;
+        }
+    }
+
+    template <typename OS>
+    void write_me(OS &output) const
+    {
+        for (uint32_t i = 0; i + 1 < dim; i++)
+        {
+            output << std::fixed << std::setprecision(6) << (float)ptr[i] << " ";
+        }
+        output << std::fixed << std::setprecision(6) << (float)ptr[dim - 1] << "\n";
+    }
+};
+
+/*
+ * rows x dim matrix in one 64-byte aligned allocation. Every row starts on
+ * a cache line: the row stride is dim rounded up to a multiple of 64 bytes
+ * (the padding is zero and never serialized). With huge_pages the arena is
+ * mmap'ed and advised for transparent huge pages, which cuts TLB misses for
+ * random row access into a large table.
+ *
+ * The serialized form is the same as std::vector<Vector<VALUE_TYPE>>, so
+ * model files are unchanged.
+ */
+template <typename VALUE_TYPE>
+class Matrix
+{
+public:
+    static const size_t ALIGNMENT = 64;
+    static const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+protected:
+    VALUE_TYPE *ptr = NULL;
+    uint32_t rows = 0;
+    uint32_t dim = 0;
+    uint32_t stride = 0;
+    size_t bytes = 0;
+    bool mapped = false;
+    bool huge_pages = false;
+
+public:
+    Matrix()
+    {
+    }
+
+    Matrix(uint32_t rows, uint32_t dim, bool huge_pages = false)
+    {
+        allocate(rows, dim, huge_pages);
+    }
+
+    Matrix(const Matrix &) = delete;
+    Matrix &operator=(const Matrix &) = delete;
+
+    virtual ~Matrix()
+    {
+        release();
+    }
+
+    void allocate(uint32_t rows, uint32_t dim, bool huge_pages = false)
+    {
+        release();
+        const size_t align = ALIGNMENT / sizeof(VALUE_TYPE);
+        this->rows = rows;
+        this->dim = dim;
+        this->stride = (uint32_t)((dim + align - 1) / align * align);
+        this->huge_pages = huge_pages;
+        bytes = (size_t)rows * stride * sizeof(VALUE_TYPE);
+        if (bytes == 0)
+        {
+            return;
+        }
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        if (huge_pages)
+        {
+            size_t len = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+            void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p != MAP_FAILED)
+            {
+                madvise(p, len, MADV_HUGEPAGE);
+                ptr = (VALUE_TYPE *)p;
+                bytes = len;
+                mapped = true;
+                return;
+            }
+            // fall back to the aligned allocation
+        }
+#endif
+        void *p = NULL;
+        if (posix_memalign(&p, ALIGNMENT, bytes) != 0)
+        {
+            throw std::bad_alloc();
+        }
+        memset(p, 0, bytes);
+        ptr = (VALUE_TYPE *)p;
+    }
+
+    void release()
+    {
+        if (ptr)
+        {
+#ifdef __linux__
+            if (mapped)
+            {
+                munmap(ptr, bytes);
+            }
+            else
+#endif
+            {
+                free(ptr);
+            }
+        }
+        ptr = NULL;
+        rows = dim = stride = 0;
+        bytes = 0;
+        mapped = false;
+    }
+
+    inline VectorView<VALUE_TYPE> row(uint32_t i) const
+    {
+        return VectorView<VALUE_TYPE>(ptr + (size_t)i * stride, dim);
+    }
+
+    inline VALUE_TYPE *data() const
+    {
+        return ptr;
+    }
+
+    uint32_t get_rows() const
+    {
+        return rows;
+    }
+
+    uint32_t get_dim() const
+    {
+        return dim;
+    }
+
+    uint32_t get_stride() const
+    {
+        return stride;
+    }
+
+    template <typename OS>
+    void write_text(OS &output) const
+    {
+        for (uint32_t i = 0; i < rows; i++)
+        {
+            row(i).write_me(output);
+        }
+    }
+
+    void write_me(bitsery::OutputStreamAdapter &bw) const
+    {
+        write(bw, (size_t)rows);
+        for (uint32_t i = 0; i < rows; i++)
+        {
+            write(bw, (size_t)dim);
+            const VALUE_TYPE *r = row(i).data();
+            for (uint32_t j = 0; j < dim; j++)
+            {
+                write(bw, r[j]);
+            }
+        }
+    }
+
+    void read_me(bitsery::InputStreamAdapter &br)
+    {
+        size_t n;
+        read(br, n);
+        read_me(br, n);
+    }
+
+    // the rest of read_me, after the number of rows
+    void read_me(bitsery::InputStreamAdapter &br, size_t n)
+    {
+        release();
+        for (size_t i = 0; i < n; i++)
+        {
+            size_t d;
+            read(br, d);
+            if (i == 0)
+            {
+                allocate((uint32_t)n, (uint32_t)d, huge_pages);
+            }
+            else if (d != dim)
+            {
+                throw std::runtime_error("rows of a matrix must have the same dimension");
+            }
+            VALUE_TYPE *r = row((uint32_t)i).data();
+            for (uint32_t j = 0; j < dim; j++)
+            {
+                read(br, r[j]);
+            }
+        }
+    }
+
+    /*
+     * The rows in a .vec.bin, with the values converted to type (rounded
+     * to nearest). FP32 is the same as write_me.
+     */
+    void write_vec_bin(bitsery::OutputStreamAdapter &bw, ValueType type) const
+    {
+        if (type == ValueType::FP32)
+        {
+            write(bw, (size_t)rows);
+        }
+        else
+        {
+            write(bw, VEC_BIN_HALF_MAGIC);
+            write(bw, (uint32_t)type);
+            write(bw, (size_t)rows);
+        }
+        for (uint32_t i = 0; i < rows; i++)
+        {
+            if (type == ValueType::FP32 || i == 0)
+            {
+                write(bw, (size_t)dim);
+            }
+            const VALUE_TYPE *r = row(i).data();
+            for (uint32_t j = 0; j < dim; j++)
+            {
+                if (type == ValueType::BF16)
+                {
+                    write(bw, bf16_t((float)r[j]));
+                }
+                else if (type == ValueType::FP16)
+                {
+                    write(bw, fp16_t((float)r[j]));
+                }
+                else
+                {
+                    write(bw, (float)r[j]);
+                }
+            }
+        }
+    }
+
+    // a .vec.bin of any precision
+    void read_vec_bin(bitsery::InputStreamAdapter &br)
+    {
+        size_t n;
+        read(br, n);
+        if (n != VEC_BIN_HALF_MAGIC)
+        {
+            read_me(br, n);
+            return;
+        }
+        uint32_t type;
+        size_t d;
+        read(br, type);
+        read(br, n);
+        read(br, d);
+        if (type != (uint32_t)ValueType::BF16 && type != (uint32_t)ValueType::FP16)
+        {
+            throw std::runtime_error("unknown value type in .vec.bin");
+        }
+        allocate((uint32_t)n, (uint32_t)d, huge_pages);
+        for (uint32_t i = 0; i < rows; i++)
+        {
+            VALUE_TYPE *r = row(i).data();
+            for (uint32_t j = 0; j < dim; j++)
+            {
+                uint16_t bits;
+                read(br, bits);
+                r[j] = type == (uint32_t)ValueType::BF16 ? bf16_t::to_float(bits) : fp16_t::to_float(bits);
+            }
+        }
+    }
+
+    // arena to use when the next read_me allocates
+    void set_huge_pages(bool huge_pages)
+    {
+        this->huge_pages = huge_pages;
+    }
+};
+
+template <typename VALUE_TYPE>
+inline void write(bitsery::OutputStreamAdapter &bw, const Matrix<VALUE_TYPE> &m)
+{
+    m.write_me(bw);
+}
+
+template <typename VALUE_TYPE>
+inline void read(bitsery::InputStreamAdapter &br, Matrix<VALUE_TYPE> &m)
+{
+    m.read_me(br);
+}
+
+#endif /* SOURCE_DIRECTORY__SRC_SPARC_MATRIX_H_ */
@@ -10,10 +10,17 @@
 
 #include <vector>
 #include <cmath>
+#include <algorithm>
 #include <iomanip>
+#include <type_traits>
+#define EIGEN_DONT_PARALLELIZE // the training loops are parallel already
+#include "Eigen/Core"
 #include "static_block.hpp"
 #include "utils.h"
 #include "io.h"
+#include "matrix.h"
+#include "sampler.h"
+#include "huffman.h"
 template <typename VALUE_TYPE>
 class Vector
 {
@@ -28,6 +35,10 @@ public:
     {
         return val;
     }
+    VectorView<VALUE_TYPE> view()
+    {
+        return VectorView<VALUE_TYPE>(val.data(), (uint32_t)val.size());
+    }
     size_t get_dim()
     {
         return val.size();
@@ -60,6 +71,10 @@ public:
         val.resize(dim);
     }
 
+    Vector(const VectorView<VALUE_TYPE> &v) : val(v.data(), v.data() + v.get_dim())
+    {
+    }
+
     void randomize()
     {
 
@@ -93,36 +108,37 @@ public:
     }
     void add(const Vector<VALUE_TYPE> &other)
     {
-        for (size_t i = 0; i < val.size(); i++)
-        {
-            val[i] += other.val.at(i);
-        }
+        vecops::add(other.val.data(), val.data(), (uint32_t)val.size());
+    }
+
+    void add(const VectorView<VALUE_TYPE> &other)
+    {
+        vecops::add(other.data(), val.data(), (uint32_t)val.size());
     }
 
     void add(const Vector<VALUE_TYPE> &other, float alpha)
     {
-        for (size_t i = 0; i < val.size(); i++)
-        {
-            val[i] += other.val.at(i) * alpha;
-        }
+        vecops::axpy(alpha, other.val.data(), val.data(), (uint32_t)val.size());
+    }
+
+    void add(const VectorView<VALUE_TYPE> &other, float alpha)
+    {
+        vecops::axpy(alpha, other.data(), val.data(), (uint32_t)val.size());
     }
 
     void mul(float x)
     {
-        for (size_t i = 0; i < val.size(); i++)
-        {
-            val[i] *= x;
-        }
+        vecops::scale(x, val.data(), (uint32_t)val.size());
     }
 
     float dot(const Vector<VALUE_TYPE> &other) const
     {
-        float r = 0;
-        for (size_t i = 0; i < val.size(); i++)
-        {
-            r += val.at(i) * other.val.at(i);
-        }
-        return r;
+        return vecops::dot(val.data(), other.val.data(), (uint32_t)val.size());
+    }
+
+    float dot(const VectorView<VALUE_TYPE> &other) const
+    {
+        return vecops::dot(other.data(), val.data(), (uint32_t)val.size());
     }
 };
 
@@ -168,119 +184,328 @@ static_block
     }
 };
 
-template <typename VALUE_TYPE>
-class OneSampleUpdator
+/*
+ * One cbow/skipgram sample with negative sampling, or with hierarchical
+ * softmax once the model has a Huffman tree. MODEL is the model type
+ * the hooks (get_vec_from_wi, add_vector_to_wo, getNegative, ...) are
+ * called on: for a final model class they are resolved at compile time and
+ * inlined, for OneSampleUpdator itself they stay virtual. DIM > 0 makes the
+ * row length a compile-time constant, DIM = 0 takes it from the model.
+ *
+ * If MODEL::LOCAL_ROWS is true the kernel reads the model's wi_ and wo_
+ * rows directly, in whatever type MODEL::storage_type they are stored, and
+ * updates the wo_ rows in place. Otherwise rows come from get_vec_from_wi
+ * and get_vec_from_wo and updates go through add_vector_to_wo. Either way
+ * the hidden layer and the gradient are VALUE_TYPE.
+ *
+ * With hierarchical softmax the label is a path of binary decisions, and
+ * the inner nodes of the tree are wo_ rows (node_row, the first rows of a
+ * single node model), so they go through the same hooks as the negatives.
+ */
+template <typename VALUE_TYPE, typename MODEL, uint32_t DIM = 0>
+class OneSampleKernel
 {
-
-protected:
-    uint32_t dim;
-    uint32_t neg_size;
-
 public:
-    uint32_t get_dim() const
+    static float update_one(MODEL &model, uint32_t label, const std::vector<uint32_t> &words, float lr, bool update_wc)
     {
-        return dim;
-    }
-    void write_me(bitsery::OutputStreamAdapter &bw) const
-    {
-        write(bw, dim);
-        write(bw, neg_size);
-    }
-    void read_me(bitsery::InputStreamAdapter &br)
-    {
-        read(br, dim);
-        read(br, neg_size);
-    }
+        if (words.empty())
+            return 0;
+        if (update_wc)
+        {
+            model.incr_word_count(label);
+        }
+        // a label that was not counted has no path, there is nothing to train
+        HuffmanTree::Path path = model.tree.path(label);
+        if (!model.tree.empty() && path.empty())
+        {
+            return 0;
+        }
+        const uint32_t dim = DIM ? DIM : model.dim;
+        thread_local Vector<VALUE_TYPE> hidden_;
+        thread_local Vector<VALUE_TYPE> grad_;
+        if (hidden_.get_dim() != dim)
+        {
+            hidden_ = Vector<VALUE_TYPE>(dim);
+            grad_ = Vector<VALUE_TYPE>(dim);
+        }
+        VALUE_TYPE *hidden = hidden_.view().data();
+        VALUE_TYPE *grad = grad_.view().data();
 
-public:
-    OneSampleUpdator()
-    {
-    }
-    OneSampleUpdator(uint32_t dim, uint32_t neg_size) : dim(dim), neg_size(neg_size)
-    {
-    }
-    virtual ~OneSampleUpdator()
-    {
-    }
+        // hidden = mean of the input rows
+        std::fill(hidden, hidden + dim, 0);
+        for (auto word : words)
+        {
+            vecops::add(wi_row(model, word), hidden, dim);
+        }
+        vecops::scale(1.0f / words.size(), hidden, dim);
 
-protected:
-    virtual void incr_word_count(uint32_t word) = 0;
-    virtual void add_vector_to_wi(const Vector<VALUE_TYPE> &v, uint32_t word, float a) = 0;
-    virtual void add_vector_to_wo(const Vector<VALUE_TYPE> &v, uint32_t word, float a) = 0;
-    virtual uint32_t getNegative(uint32_t target) = 0;
-    virtual Vector<VALUE_TYPE> get_vec_from_wi(uint32_t) = 0;
-    virtual Vector<VALUE_TYPE> get_vec_from_wo(uint32_t) = 0;
+        std::fill(grad, grad + dim, 0);
+        float loss = output(model, label, path, lr, hidden_, grad, dim);
 
-    float update_one(uint32_t label, const std::vector<uint32_t> &words, float lr, bool update_wc)
+        for (auto word : words)
+        {
+            model.add_vector_to_wi(grad_, word, 1.0f);
+        }
+        return loss;
+    }
+
+    /*
+     * CBOW over the labels words[begin, end), the same as update_one for
+     * every position but with the window kept as a running sum: the sum
+     * of the rows of words[i-half_window, i+half_window), center included,
+     * gets the row entering the window added and the row leaving it
+     * subtracted, and the center row is subtracted for the hidden layer.
+     * Three wi_ rows are read per position instead of the whole window.
+     *
+     * After a position every input row got grad added once per occurrence
+     * of its word among the inputs, so the sum gets grad times the number
+     * of (input, window slot) pairs with the same word and stays exact up
+     * to rounding. It is summed from scratch every RESUM positions anyway,
+     * for the rounding of 16-bit rows and the updates of other threads.
+     * Returns the mean loss.
+     */
+    static float update_cbow(MODEL &model, const std::vector<uint32_t> &words, size_t begin, size_t end, uint32_t half_window, float lr, bool update_wc)
     {
-        if (words.empty())
-            return 0;
-        if (update_wc)
+        static constexpr int RESUM = 128;
+        const uint32_t dim = DIM ? DIM : model.dim;
+        thread_local Vector<VALUE_TYPE> hidden_;
+        thread_local Vector<VALUE_TYPE> grad_;
+        thread_local Vector<VALUE_TYPE> sum_;
+        thread_local Vector<VALUE_TYPE> row_;
+        if (hidden_.get_dim() != dim)
         {
-            incr_word_count(label);
+            hidden_ = Vector<VALUE_TYPE>(dim);
+            grad_ = Vector<VALUE_TYPE>(dim);
+            sum_ = Vector<VALUE_TYPE>(dim);
+            row_ = Vector<VALUE_TYPE>(dim);
         }
-        float loss = 0;
-        if (true)
+        VALUE_TYPE *hidden = hidden_.view().data();
+        VALUE_TYPE *grad = grad_.view().data();
+        VALUE_TYPE *sum = sum_.view().data();
+        VALUE_TYPE *row = row_.view().data();
+        // y -= wi_[word], 16-bit rows only add to float so they go through row
+        auto subtract = [&](uint32_t word, VALUE_TYPE *y)
+        {
+            auto *x = wi_row(model, word);
+            if constexpr (std::is_same<std::remove_pointer_t<decltype(x)>, VALUE_TYPE>::value)
+            {
+                vecops::axpy(-1.0f, x, y, dim);
+            }
+            else
+            {
+                std::fill(row, row + dim, 0);
+                vecops::add(x, row, dim);
+                vecops::axpy(-1.0f, row, y, dim);
+            }
+        };
+
+        auto occurrences = [&words](uint32_t word, int from, int to)
+        {
+            return (uint32_t)std::count(words.begin() + from, words.begin() + to, word);
+        };
+
+        const int ws = (int)words.size();
+        const int hw = (int)half_window;
+        int lo = 0, hi = 0; // sum holds the rows of words[lo, hi)
+        uint32_t same = 0;  // ordered pairs of different slots of [lo, hi) with the same word
+        int summed = 0;     // position of the last sum from scratch
+        float loss = 0.0f;
+        for (int i = (int)begin; i < (int)end; i++)
         {
-            thread_local Vector<VALUE_TYPE> hidden_(dim);
-            thread_local Vector<VALUE_TYPE> grad_(dim);
-            computeHidden(words, hidden_);
-            loss += negativeSampling(label, lr, hidden_, grad_);
-            for (auto word : words)
+            int first = std::max(i - hw, 0);
+            int last = std::min(i + hw, ws);
+            int n = last - first - (hw > 0 ? 1 : 0);
+            if (n <= 0)
+            {
+                continue;
+            }
+            uint32_t label = words[i];
+            if (update_wc)
+            {
+                model.incr_word_count(label);
+            }
+            HuffmanTree::Path path = model.tree.path(label);
+            if (!model.tree.empty() && path.empty())
+            {
+                continue;
+            }
+
+            if (lo == hi || first >= hi || i - summed >= RESUM)
+            {
+                std::fill(sum, sum + dim, 0);
+                lo = hi = first;
+                same = 0;
+                summed = i;
+            }
+            for (; lo < first; lo++)
             {
-                add_vector_to_wi(grad_, word, 1.0f);
+                subtract(words[lo], sum);
+                same -= 2 * occurrences(words[lo], lo + 1, hi);
             }
+            for (; hi < last; hi++)
+            {
+                vecops::add(wi_row(model, words[hi]), sum, dim);
+                same += 2 * occurrences(words[hi], lo, hi);
+            }
+
+            std::copy(sum, sum + dim, hidden);
+            subtract(label, hidden);
+            vecops::scale(1.0f / n, hidden, dim);
+
+            std::fill(grad, grad + dim, 0);
+            loss += output(model, label, path, lr, hidden_, grad, dim);
+
+            for (int j = first; j < last; j++)
+            {
+                if (j != i)
+                {
+                    model.add_vector_to_wi(grad_, words[j], 1.0f);
+                }
+            }
+            // every slot pairs with itself and the other slots of its word,
+            // minus the pairs with the center, which got nothing
+            uint32_t pairs = (last - first) + same - occurrences(label, first, last);
+            vecops::axpy((float)pairs, grad, sum, dim);
         }
-        return loss;
+        return end > begin ? loss / (end - begin) : 0;
     }
 
-private:
-    void computeHidden(const std::vector<uint32_t> &words, Vector<VALUE_TYPE> &hidden_)
+    /*
+     * Skipgram for one center position: every context word predicts the
+     * label against the same neg_size negatives. The label and negative
+     * rows are fetched once into VALUE_TYPE, trained in place for one
+     * context after the other, and only their change is written back, so
+     * a position costs neg_size+1 random wo_ rows instead of that many per
+     * context. Returns the sum of the losses of the contexts.
+     */
+    static float update_shared(MODEL &model, uint32_t label, const std::vector<uint32_t> &contexts, float lr, bool update_wc)
     {
+        if (contexts.empty())
+            return 0;
+        const uint32_t dim = DIM ? DIM : model.dim;
+        const uint32_t num_out = model.neg_size + 1;
+        thread_local Vector<VALUE_TYPE> hidden_;
+        thread_local Vector<VALUE_TYPE> grad_;
+        thread_local Vector<VALUE_TYPE> delta_;
+        thread_local std::vector<VALUE_TYPE> out, start;
+        thread_local std::vector<uint32_t> rows;
+        if (hidden_.get_dim() != dim)
+        {
+            hidden_ = Vector<VALUE_TYPE>(dim);
+            grad_ = Vector<VALUE_TYPE>(dim);
+            delta_ = Vector<VALUE_TYPE>(dim);
+        }
+        VALUE_TYPE *hidden = hidden_.view().data();
+        VALUE_TYPE *grad = grad_.view().data();
 
-        hidden_.zero();
-        if (words.empty())
+        rows.resize(num_out);
+        out.resize((size_t)num_out * dim);
+        rows[0] = label;
+        for (uint32_t n = 1; n < num_out; n++)
         {
-            return;
+            rows[n] = model.getNegative(label);
+        }
+        for (uint32_t n = 0; n < num_out; n++)
+        {
+            std::fill(&out[(size_t)n * dim], &out[(size_t)n * dim] + dim, 0);
+            vecops::add(wo_row(model, rows[n]), &out[(size_t)n * dim], dim);
         }
+        start = out;
 
-        for (auto word : words)
+        float loss = 0.0f;
+        for (auto word : contexts)
         {
-            auto v = get_vec_from_wi(word);
-            hidden_.add(v);
+            if (update_wc)
+            {
+                model.incr_word_count(label);
+            }
+            std::fill(hidden, hidden + dim, 0);
+            vecops::add(wi_row(model, word), hidden, dim);
+            std::fill(grad, grad + dim, 0);
+            float l = 0.0f;
+            for (uint32_t n = 0; n < num_out; n++)
+            {
+                l += logistic(&out[(size_t)n * dim], n == 0, lr, hidden, grad, dim);
+            }
+            loss += l / model.neg_size;
+            model.add_vector_to_wi(grad_, word, 1.0f);
         }
 
-        hidden_.mul(1.0f / words.size());
+        VALUE_TYPE *delta = delta_.view().data();
+        for (uint32_t n = 0; n < num_out; n++)
+        {
+            for (uint32_t i = 0; i < dim; i++)
+            {
+                delta[i] = out[(size_t)n * dim + i] - start[(size_t)n * dim + i];
+            }
+            if constexpr (MODEL::LOCAL_ROWS)
+            {
+                vecops::axpy(1.0f, delta, wo_row(model, rows[n]), dim);
+            }
+            else
+            {
+                model.add_vector_to_wo(delta_, rows[n], 1.0f);
+            }
+        }
+        return loss;
     }
 
-    float negativeSampling(uint32_t target, float lr, Vector<VALUE_TYPE> &hidden_, Vector<VALUE_TYPE> &grad_)
+private:
+    // the label against its negatives, or down its path if there is a tree
+    static float output(MODEL &model, uint32_t label, const HuffmanTree::Path &path, float lr, Vector<VALUE_TYPE> &hidden_, VALUE_TYPE *grad, uint32_t dim)
     {
         float loss = 0.0f;
-        grad_.zero();
-        for (uint32_t n = 0; n <= neg_size; n++)
+        if (model.tree.empty())
         {
-            if (n == 0)
+            for (uint32_t n = 0; n <= model.neg_size; n++)
             {
-                loss += binaryLogistic(target, true, lr, hidden_, grad_);
+                if (n == 0)
+                {
+                    loss += binaryLogistic(model, label, true, lr, hidden_, grad, dim);
+                }
+                else
+                {
+                    loss += binaryLogistic(model, model.getNegative(label), false, lr, hidden_, grad, dim);
+                }
             }
-            else
+            loss /= model.neg_size;
+        }
+        else
+        {
+            for (uint32_t step : path)
             {
-                loss += binaryLogistic(getNegative(target), false, lr, hidden_, grad_);
+                loss += binaryLogistic(model, model.node_row(HuffmanTree::node(step)), !HuffmanTree::code(step), lr, hidden_, grad, dim);
             }
         }
-        return loss / neg_size;
+        return loss;
     }
 
-    float binaryLogistic(uint32_t label, bool ytruth, float lr, Vector<VALUE_TYPE> &hidden_, Vector<VALUE_TYPE> &grad_)
+    static float binaryLogistic(MODEL &model, uint32_t label, bool ytruth, float lr, Vector<VALUE_TYPE> &hidden_, VALUE_TYPE *grad, uint32_t dim)
     {
-        auto v = get_vec_from_wo(label);
-        float x = v.dot(hidden_);
-        //fprintf(stderr, "x=%f %f %f \n", x, hidden_.at(0), v.at(0));
-        float score = sigmoid(x);
+        VALUE_TYPE *hidden = hidden_.view().data();
+        auto *v = wo_row(model, label);
+        if constexpr (MODEL::LOCAL_ROWS)
+        {
+            return logistic(v, ytruth, lr, hidden, grad, dim);
+        }
+        else
+        {
+            float score = sigmoid(vecops::dot(v, hidden, dim));
+            float alpha = lr * ((ytruth ? 1.0f : 0.0f) - score);
+            vecops::axpy(alpha, v, grad, dim);
+            model.add_vector_to_wo(hidden_, label, alpha); //wo[label]+=hidden_
+            return ytruth ? -log(score) : -log(1.0f - score);
+        }
+    }
 
+    // one output on the row v, which is updated in place
+    template <typename ROW>
+    static float logistic(ROW *v, bool ytruth, float lr, const VALUE_TYPE *hidden, VALUE_TYPE *grad, uint32_t dim)
+    {
+        float score = sigmoid(vecops::dot(v, hidden, dim));
         float alpha = lr * ((ytruth ? 1.0f : 0.0f) - score);
-        grad_.add(v, alpha);
-        add_vector_to_wo(hidden_, label, alpha); //wo[label]+=hidden_
+        // grad+=v*alpha and v+=hidden*alpha in one pass
+        vecops::axpy2(alpha, v, hidden, grad, dim);
         if (ytruth)
         {
             return -log(score);
@@ -291,7 +516,33 @@ private:
         }
     }
 
-    float log(float x)
+public:
+    // shared with MinibatchKernel
+    static auto *wi_row(MODEL &model, uint32_t word)
+    {
+        if constexpr (MODEL::LOCAL_ROWS)
+        {
+            return model.wi_.row(word).data();
+        }
+        else
+        {
+            return model.get_vec_from_wi(word).data();
+        }
+    }
+
+    static auto *wo_row(MODEL &model, uint32_t word)
+    {
+        if constexpr (MODEL::LOCAL_ROWS)
+        {
+            return model.wo_.row(word).data();
+        }
+        else
+        {
+            return model.get_vec_from_wo(word).data();
+        }
+    }
+
+    static float log(float x)
     {
         if (x > 1.0)
         {
@@ -301,7 +552,7 @@ private:
         return t_log_[i];
     }
 
-    float sigmoid(float x)
+    static float sigmoid(float x)
     {
         if (x < -MAX_SIGMOID)
         {
@@ -319,12 +570,378 @@ private:
     }
 };
 
+/*
+ * Minibatched cbow/skipgram with negative sampling, for models with local
+ * rows. Up to batch samples (cbow windows, or skipgram (context, label)
+ * pairs) share neg_size negatives, so the scores of all of them against
+ * the negatives are one GEMM of the hidden layers with the negative rows,
+ * and their gradients two more. A label equal to one of the negatives
+ * just has one negative less.
+ *
+ * Every wi_ and wo_ row the batch touches is converted to VALUE_TYPE once
+ * before it, and gets the sum of its gradients scatter-added once after
+ * it, without locks like the single sample kernel. Within a batch every
+ * sample sees the rows as they were at its start, so a negative, whose
+ * steps are summed over the whole batch, overshoots for large batches and
+ * large rates. max_lr(batch) is the largest rate at which the loss still
+ * followed the single sample kernel when training the same data with both
+ * (knucleotide, a 15 bit hash), above it it diverged. The kernel trains
+ * with the rate it is given, train scales its schedule down to max_lr.
+ *
+ * The GEMMs are Eigen's, built for the baseline ISA. The rest goes through
+ * vecops.
+ */
+template <typename VALUE_TYPE, typename MODEL>
+class MinibatchKernel
+{
+    typedef Eigen::Matrix<VALUE_TYPE, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrix;
+    typedef Eigen::Map<RowMatrix> Block;
+    typedef OneSampleKernel<VALUE_TYPE, MODEL> Kernel;
+
+    struct Batch
+    {
+        std::vector<uint32_t> labels;
+        std::vector<uint32_t> inputs;
+        std::vector<uint32_t> first{0}; // inputs of sample s are [first[s], first[s+1])
+
+        size_t size() const
+        {
+            return labels.size();
+        }
+
+        void clear()
+        {
+            labels.clear();
+            inputs.clear();
+            first.resize(1);
+        }
+
+        void add(uint32_t label)
+        {
+            labels.push_back(label);
+            first.push_back((uint32_t)inputs.size());
+        }
+    };
+
+public:
+    static float max_lr(uint32_t batch_size)
+    {
+        return 0.5f / std::sqrt((float)std::max(batch_size, 1u));
+    }
+
+    // same windows, word counts and loss as Model::update
+    static float update(MODEL &model, const std::vector<uint32_t> &words, size_t begin, size_t end, float lr, bool update_wc, uint32_t batch_size)
+    {
+        end = std::min(end, words.size());
+        thread_local Batch batch;
+        batch.clear();
+        float loss = 0;
+        uint32_t count = 0;
+        int ws = (int)words.size();
+        int half_window = (int)model.half_window;
+        for (int i = (int)begin; i < (int)end; i++)
+        {
+            uint32_t label = words[i];
+            size_t before = batch.inputs.size();
+            for (int j = i - half_window; j < i + half_window; j++)
+            {
+                if (j >= 0 && j != i && j < ws)
+                {
+                    batch.inputs.push_back(words[j]);
+                    if (!model.use_cbow)
+                    {
+                        batch.add(label);
+                        count++;
+                        loss += flush(model, batch, batch_size, lr, update_wc);
+                    }
+                }
+            }
+            if (model.use_cbow)
+            {
+                // an empty window counts, but trains nothing
+                if (batch.inputs.size() > before)
+                {
+                    batch.add(label);
+                    loss += flush(model, batch, batch_size, lr, update_wc);
+                }
+                count++;
+            }
+        }
+        if (batch.size() > 0)
+        {
+            loss += train(model, batch, lr, update_wc);
+        }
+        return count == 0 ? 0 : loss / count;
+    }
+
+protected:
+    // trains the batch once it is full
+    static float flush(MODEL &model, Batch &batch, uint32_t batch_size, float lr, bool update_wc)
+    {
+        if (batch.size() < batch_size)
+        {
+            return 0;
+        }
+        float loss = train(model, batch, lr, update_wc);
+        batch.clear();
+        return loss;
+    }
+
+    // a rows x cols view of a buffer of the calling thread, which only grows
+    static Block block(std::vector<VALUE_TYPE> &buf, size_t rows, size_t cols)
+    {
+        if (buf.size() < rows * cols)
+        {
+            buf.resize(rows * cols);
+        }
+        return Block(buf.data(), rows, cols);
+    }
+
+    static void sort_unique(std::vector<uint32_t> &v)
+    {
+        std::sort(v.begin(), v.end());
+        v.erase(std::unique(v.begin(), v.end()), v.end());
+    }
+
+    static uint32_t find(const std::vector<uint32_t> &v, size_t first, size_t last, uint32_t word)
+    {
+        return (uint32_t)(std::lower_bound(v.begin() + first, v.begin() + last, word) - v.begin());
+    }
+
+    template <typename ROW>
+    static void load(const ROW *row, VALUE_TYPE *dst, uint32_t dim)
+    {
+        std::fill(dst, dst + dim, 0);
+        vecops::add(row, dst, dim);
+    }
+
+    // the sum of the per sample losses of Model::update
+    static float train(MODEL &model, const Batch &batch, float lr, bool update_wc)
+    {
+        const uint32_t dim = model.dim;
+        const size_t n = batch.size();
+        if (update_wc)
+        {
+            for (uint32_t label : batch.labels)
+            {
+                model.incr_word_count(label);
+            }
+        }
+
+        // the output rows are the distinct negatives, with how often each
+        // was drawn, then the labels that are not among them
+        thread_local std::vector<uint32_t> out, mult, in, in_row, label_row;
+        out.clear();
+        for (uint32_t k = 0; k < model.neg_size; k++)
+        {
+            out.push_back(model.sampler.sample());
+        }
+        std::sort(out.begin(), out.end());
+        mult.clear();
+        for (size_t k = 0; k < out.size(); k++)
+        {
+            if (k == 0 || out[k] != out[k - 1])
+            {
+                mult.push_back(0);
+            }
+            mult.back()++;
+        }
+        sort_unique(out);
+        const size_t num_neg = out.size();
+        for (uint32_t label : batch.labels)
+        {
+            if (!std::binary_search(out.begin(), out.begin() + num_neg, label))
+            {
+                out.push_back(label);
+            }
+        }
+        std::sort(out.begin() + num_neg, out.end());
+        out.erase(std::unique(out.begin() + num_neg, out.end()), out.end());
+        label_row.resize(n);
+        for (size_t s = 0; s < n; s++)
+        {
+            uint32_t c = find(out, 0, num_neg, batch.labels[s]);
+            label_row[s] = c < num_neg && out[c] == batch.labels[s] ? c : find(out, num_neg, out.size(), batch.labels[s]);
+        }
+        in = batch.inputs;
+        sort_unique(in);
+        in_row.resize(batch.inputs.size());
+        for (size_t i = 0; i < batch.inputs.size(); i++)
+        {
+            in_row[i] = find(in, 0, in.size(), batch.inputs[i]);
+        }
+
+        thread_local std::vector<VALUE_TYPE> b_wo, b_wi, b_h, b_s, b_gh, b_go, b_gi, pos_err;
+        Block wo = block(b_wo, out.size(), dim);
+        Block wi = block(b_wi, in.size(), dim);
+        for (size_t c = 0; c < out.size(); c++)
+        {
+            load(Kernel::wo_row(model, out[c]), &wo(c, 0), dim);
+        }
+        for (size_t u = 0; u < in.size(); u++)
+        {
+            load(Kernel::wi_row(model, in[u]), &wi(u, 0), dim);
+        }
+
+        // hidden = mean of the input rows of every sample
+        Block h = block(b_h, n, dim);
+        for (size_t s = 0; s < n; s++)
+        {
+            std::fill(&h(s, 0), &h(s, 0) + dim, 0);
+            for (uint32_t i = batch.first[s]; i < batch.first[s + 1]; i++)
+            {
+                vecops::add(&wi(in_row[i], 0), &h(s, 0), dim);
+            }
+            vecops::scale(1.0f / (batch.first[s + 1] - batch.first[s]), &h(s, 0), dim);
+        }
+
+        // the scores against the negatives, turned into errors in place
+        Block err = block(b_s, n, num_neg);
+        err.noalias() = h * wo.topRows(num_neg).transpose();
+        pos_err.resize(n);
+        float loss = 0;
+        for (size_t s = 0; s < n; s++)
+        {
+            uint32_t c = label_row[s];
+            float score = Kernel::sigmoid(vecops::dot(&h(s, 0), &wo(c, 0), dim));
+            pos_err[s] = lr * (1.0f - score);
+            float l = -Kernel::log(score);
+            for (size_t k = 0; k < num_neg; k++)
+            {
+                if (k == c)
+                {
+                    err(s, k) = 0;
+                    continue;
+                }
+                score = Kernel::sigmoid(err(s, k));
+                err(s, k) = -lr * score * mult[k];
+                l -= Kernel::log(1.0f - score) * mult[k];
+            }
+            loss += l / model.neg_size;
+        }
+
+        // gradients of the hidden layers and of the output rows
+        Block gh = block(b_gh, n, dim);
+        gh.noalias() = err * wo.topRows(num_neg);
+        Block go = block(b_go, out.size(), dim);
+        go.topRows(num_neg).noalias() = err.transpose() * h;
+        std::fill(&go(0, 0) + num_neg * dim, &go(0, 0) + out.size() * dim, 0);
+        for (size_t s = 0; s < n; s++)
+        {
+            vecops::axpy(pos_err[s], &wo(label_row[s], 0), &gh(s, 0), dim);
+            vecops::axpy(pos_err[s], &h(s, 0), &go(label_row[s], 0), dim);
+        }
+
+        // every input of a sample gets its whole hidden gradient
+        Block gi = block(b_gi, in.size(), dim);
+        std::fill(&gi(0, 0), &gi(0, 0) + in.size() * dim, 0);
+        for (size_t s = 0; s < n; s++)
+        {
+            for (uint32_t i = batch.first[s]; i < batch.first[s + 1]; i++)
+            {
+                vecops::add(&gh(s, 0), &gi(in_row[i], 0), dim);
+            }
+        }
+
+        for (size_t c = 0; c < out.size(); c++)
+        {
+            vecops::axpy(1.0f, &go(c, 0), Kernel::wo_row(model, out[c]), dim);
+        }
+        for (size_t u = 0; u < in.size(); u++)
+        {
+            vecops::axpy(1.0f, &gi(u, 0), Kernel::wi_row(model, in[u]), dim);
+        }
+        return loss;
+    }
+};
+
+template <typename VALUE_TYPE>
+class OneSampleUpdator
+{
+    template <typename, typename, uint32_t>
+    friend class OneSampleKernel;
+
+protected:
+    uint32_t dim;
+    uint32_t neg_size;
+    HuffmanTree tree; // empty for negative sampling
+
+public:
+    // rows from get_vec_from_wo are not the model's storage
+    static const bool LOCAL_ROWS = false;
+
+    uint32_t get_dim() const
+    {
+        return dim;
+    }
+    const HuffmanTree &get_tree() const
+    {
+        return tree;
+    }
+    void write_me(bitsery::OutputStreamAdapter &bw) const
+    {
+        write(bw, dim);
+        write(bw, neg_size);
+    }
+    void read_me(bitsery::InputStreamAdapter &br)
+    {
+        read(br, dim);
+        read(br, neg_size);
+    }
+
+public:
+    OneSampleUpdator()
+    {
+    }
+    OneSampleUpdator(uint32_t dim, uint32_t neg_size) : dim(dim), neg_size(neg_size)
+    {
+    }
+    virtual ~OneSampleUpdator()
+    {
+    }
+
+protected:
+    virtual void incr_word_count(uint32_t word) = 0;
+    virtual void add_vector_to_wi(const Vector<VALUE_TYPE> &v, uint32_t word, float a) = 0;
+    virtual void add_vector_to_wo(const Vector<VALUE_TYPE> &v, uint32_t word, float a) = 0;
+    virtual uint32_t getNegative(uint32_t target) = 0;
+    // the wo_ row of an inner node of the tree
+    virtual uint32_t node_row(uint32_t node)
+    {
+        return node;
+    }
+    /*
+     * Rows are returned as views, no copy is made. A local model returns a
+     * view of its own storage; a remote model fetches the row into a buffer
+     * it owns, so the view is only valid until the next get_vec_from_wi
+     * (resp. get_vec_from_wo) call of the same thread.
+     */
+    virtual VectorView<VALUE_TYPE> get_vec_from_wi(uint32_t) = 0;
+    virtual VectorView<VALUE_TYPE> get_vec_from_wo(uint32_t) = 0;
+
+    // dynamic path, every hook is a virtual call. Models with local rows
+    // override this with a devirtualized kernel.
+    virtual float update_one(uint32_t label, const std::vector<uint32_t> &words, float lr, bool update_wc)
+    {
+        return OneSampleKernel<VALUE_TYPE, OneSampleUpdator<VALUE_TYPE>>::update_one(*this, label, words, lr, update_wc);
+    }
+    virtual float update_shared(uint32_t label, const std::vector<uint32_t> &contexts, float lr, bool update_wc)
+    {
+        return OneSampleKernel<VALUE_TYPE, OneSampleUpdator<VALUE_TYPE>>::update_shared(*this, label, contexts, lr, update_wc);
+    }
+    virtual float update_cbow(const std::vector<uint32_t> &words, size_t begin, size_t end, uint32_t half_window, float lr, bool update_wc)
+    {
+        return OneSampleKernel<VALUE_TYPE, OneSampleUpdator<VALUE_TYPE>>::update_cbow(*this, words, begin, end, half_window, lr, update_wc);
+    }
+};
+
 template <typename VALUE_TYPE>
 class Model : public OneSampleUpdator<VALUE_TYPE>
 {
 protected:
     bool use_cbow;
     uint32_t half_window;
+    bool shared_negatives = false; // a training option, not saved
 
 public:
     void read_me(bitsery::InputStreamAdapter &br)
@@ -364,24 +981,44 @@ public:
 
     virtual void randomize_init() = 0;
 
+    // skipgram with negative sampling only: one negative set per center
+    // position, shared by all its context words
+    void set_shared_negatives(bool b)
+    {
+        shared_negatives = b;
+    }
+
     float update(const std::vector<uint32_t> &words, float lr, bool update_wc)
     {
-        if (words.empty())
+        return update(words, 0, words.size(), lr, update_wc);
+    }
+
+    /*
+     * Only the words in [begin, end) are labels, their windows still see
+     * the words around them, so a long read can be trained in pieces.
+     */
+    virtual float update(const std::vector<uint32_t> &words, size_t begin, size_t end, float lr, bool update_wc)
+    {
+        end = std::min(end, words.size());
+        if (begin >= end)
         {
             return 0;
         }
+        if (use_cbow)
+        {
+            return this->update_cbow(words, begin, end, half_window, lr, update_wc);
+        }
         float loss = 0;
         uint32_t count = 0;
         int ws = (int)words.size();
         int half_window = (int)this->half_window;
-        std::vector<uint32_t> input_words;
-        for (int i = 0; i < (int)words.size(); i++)
+        thread_local std::vector<uint32_t> input_words;
+        for (int i = (int)begin; i < (int)end; i++)
         {
             input_words.clear();
             uint32_t label = words.at(i);
-            if (use_cbow)
+            if (shared_negatives && this->tree.empty())
             {
-
                 for (int j = (int)(i - half_window); j < i + half_window; j++)
                 {
                     if (j >= 0 && j != i && j < ws)
@@ -389,8 +1026,8 @@ public:
                         input_words.push_back(words.at(j));
                     }
                 }
-                loss += this->update_one(label, input_words, lr, update_wc);
-                count++;
+                loss += this->update_shared(label, input_words, lr, update_wc);
+                count += input_words.size();
             }
             else
             {
@@ -417,14 +1054,27 @@ public:
     }
 };
 
-template <typename VALUE_TYPE>
-class SingleNodeModel : public Model<VALUE_TYPE>
+/*
+ * The whole model in local memory. The embedding tables are stored as
+ * STORAGE_TYPE, which can be bf16_t or fp16_t to halve their size; the
+ * training kernels convert rows to VALUE_TYPE on the fly and round updates
+ * back stochastically.
+ */
+template <typename VALUE_TYPE, typename STORAGE_TYPE = VALUE_TYPE>
+class SingleNodeModel final : public Model<VALUE_TYPE>
 {
+    template <typename, typename, uint32_t>
+    friend class OneSampleKernel;
+    template <typename, typename>
+    friend class MinibatchKernel;
+
 protected:
     uint32_t num_word;
-    std::vector<Vector<VALUE_TYPE>> wo_;
-    std::vector<Vector<VALUE_TYPE>> wi_;
+    Matrix<STORAGE_TYPE> wo_;
+    Matrix<STORAGE_TYPE> wi_;
     std::vector<uint32_t> word_count;
+    NegativeSampler sampler;
+    uint32_t minibatch = 0;
 
 public:
     void read_me(bitsery::InputStreamAdapter &br)
@@ -434,6 +1084,7 @@ public:
         read(br, wo_);
         read(br, wi_);
         read(br, word_count);
+        sampler.set_uniform(num_word);
     }
 
     void write_me(bitsery::OutputStreamAdapter &bw) const
@@ -448,10 +1099,7 @@ public:
     template <typename OS>
     void write_vec(OS &output)
     {
-        for (auto &x : wi_)
-        {
-            x.write_me(output);
-        }
+        wi_.write_text(output);
     }
 
     template <typename OS>
@@ -463,79 +1111,223 @@ public:
         }
     }
 
-    void write_vec_bin(bitsery::OutputStreamAdapter &bw)
+    // the input rows as a .vec.bin of the given precision
+    void write_vec_bin(bitsery::OutputStreamAdapter &bw, ValueType type)
     {
-        write(bw, wi_);
+        wi_.write_vec_bin(bw, type);
     }
 
 public:
+    typedef STORAGE_TYPE storage_type;
+    static const bool LOCAL_ROWS = true;
+
     SingleNodeModel() : Model<VALUE_TYPE>()
     {
     }
-    SingleNodeModel(uint32_t num_word, uint32_t dim, uint32_t neg_size, bool use_cbow, uint32_t half_window) : Model<VALUE_TYPE>(dim, neg_size, use_cbow, half_window), num_word(num_word)
+    SingleNodeModel(uint32_t num_word, uint32_t dim, uint32_t neg_size, bool use_cbow, uint32_t half_window, bool huge_pages = false)
+        : Model<VALUE_TYPE>(dim, neg_size, use_cbow, half_window), num_word(num_word), wo_(num_word, dim, huge_pages), wi_(num_word, dim, huge_pages), sampler(num_word)
     {
-        for (uint32_t i = 0; i < num_word; i++)
+        word_count.resize(num_word);
+    }
+
+    // draw negatives from count^power, with the counts collected in epoch 0
+    bool build_unigram_sampler(double power = 0.75)
+    {
+        return sampler.build_unigram(word_count, power);
+    }
+
+    // same with counts from elsewhere, e.g. the .wc.txt of a previous run
+    bool build_unigram_sampler(const std::vector<uint32_t> &counts, double power = 0.75)
+    {
+        return sampler.build_unigram(counts, power);
+    }
+
+    const NegativeSampler &get_sampler() const
+    {
+        return sampler;
+    }
+
+    // samples per MinibatchKernel batch, 0 trains one sample at a time
+    void set_minibatch(uint32_t batch)
+    {
+        minibatch = batch;
+    }
+
+    using Model<VALUE_TYPE>::update;
+
+    // hierarchical softmax is always trained one sample at a time
+    float update(const std::vector<uint32_t> &words, size_t begin, size_t end, float lr, bool update_wc) override
+    {
+        if (minibatch > 0 && this->tree.empty())
         {
-            wo_.push_back(Vector<VALUE_TYPE>(dim));
-            wi_.push_back(Vector<VALUE_TYPE>(dim));
+            return MinibatchKernel<VALUE_TYPE, SingleNodeModel>::update(*this, words, begin, end, lr, update_wc, minibatch);
         }
-        word_count.resize(num_word);
+        return Model<VALUE_TYPE>::update(words, begin, end, lr, update_wc);
+    }
+
+    /*
+     * Switch to hierarchical softmax over a Huffman tree of the counts
+     * collected in epoch 0, or of counts from elsewhere. The first rows of
+     * wo_ become the inner nodes and start from zero. Returns false and
+     * keeps negative sampling if fewer than two buckets were seen.
+     */
+    bool build_huffman_tree()
+    {
+        return build_huffman_tree(word_count);
+    }
+
+    bool build_huffman_tree(const std::vector<uint32_t> &counts)
+    {
+        if (!this->tree.build(counts))
+        {
+            return false;
+        }
+        for (uint32_t i = 0; i < this->tree.num_nodes(); i++)
+        {
+            wo_.row(i).fill(0);
+        }
+        return true;
+    }
+
+    const std::vector<uint32_t> &get_word_count() const
+    {
+        return word_count;
     }
 
     void randomize_init()
     {
         for (uint32_t i = 0; i < num_word; i++)
         {
-            wo_[i].randomize();
-            wi_[i].randomize();
+            wo_.row(i).randomize();
+            wi_.row(i).randomize();
         }
     }
 
     void uniform_init()
     {
+        float x = 1.0 / this->dim;
         for (uint32_t i = 0; i < num_word; i++)
         {
-            wo_[i].uniform();
-            wi_[i].uniform();
+            wo_.row(i).fill(x);
+            wi_.row(i).fill(x);
         }
     }
 
 protected:
+    // the hooks below are inlined into the kernel, with the common
+    // dimensions unrolled at compile time
+    float update_one(uint32_t label, const std::vector<uint32_t> &words, float lr, bool update_wc) override
+    {
+        switch (this->dim)
+        {
+        case 100:
+            return OneSampleKernel<VALUE_TYPE, SingleNodeModel, 100>::update_one(*this, label, words, lr, update_wc);
+        case 128:
+            return OneSampleKernel<VALUE_TYPE, SingleNodeModel, 128>::update_one(*this, label, words, lr, update_wc);
+        case 200:
+            return OneSampleKernel<VALUE_TYPE, SingleNodeModel, 200>::update_one(*this, label, words, lr, update_wc);
+        case 256:
+            return OneSampleKernel<VALUE_TYPE, SingleNodeModel, 256>::update_one(*this, label, words, lr, update_wc);
+        case 300:
+            return OneSampleKernel<VALUE_TYPE, SingleNodeModel, 300>::update_one(*this, label, words, lr, update_wc);
+        default:
+            return OneSampleKernel<VALUE_TYPE, SingleNodeModel>::update_one(*this, label, words, lr, update_wc);
+        }
+    }
+
+    float update_shared(uint32_t label, const std::vector<uint32_t> &contexts, float lr, bool update_wc) override
+    {
+        switch (this->dim)
+        {
+        case 100:
+            return OneSampleKernel<VALUE_TYPE, SingleNodeModel, 100>::update_shared(*this, label, contexts, lr, update_wc);
+        case 128:
+            return OneSampleKernel<VALUE_TYPE, SingleNodeModel, 128>::update_shared(*this, label, contexts, lr, update_wc);
+        case 200:
+            return OneSampleKernel<VALUE_TYPE, SingleNodeModel, 200>::update_shared(*this, label, contexts, lr, update_wc);
+        case 256:
+            return OneSampleKernel<VALUE_TYPE, SingleNodeModel, 256>::update_shared(*this, label, contexts, lr, update_wc);
+        case 300:
+            return OneSampleKernel<VALUE_TYPE, SingleNodeModel, 300>::update_shared(*this, label, contexts, lr, update_wc);
+        default:
+            return OneSampleKernel<VALUE_TYPE, SingleNodeModel>::update_shared(*this, label, contexts, lr, update_wc);
+        }
+    }
+
+    float update_cbow(const std::vector<uint32_t> &words, size_t begin, size_t end, uint32_t half_window, float lr, bool update_wc) override
+    {
+        switch (this->dim)
+        {
+        case 100:
+            return OneSampleKernel<VALUE_TYPE, SingleNodeModel, 100>::update_cbow(*this, words, begin, end, half_window, lr, update_wc);
+        case 128:
+            return OneSampleKernel<VALUE_TYPE, SingleNodeModel, 128>::update_cbow(*this, words, begin, end, half_window, lr, update_wc);
+        case 200:
+            return OneSampleKernel<VALUE_TYPE, SingleNodeModel, 200>::update_cbow(*this, words, begin, end, half_window, lr, update_wc);
+        case 256:
+            return OneSampleKernel<VALUE_TYPE, SingleNodeModel, 256>::update_cbow(*this, words, begin, end, half_window, lr, update_wc);
+        case 300:
+            return OneSampleKernel<VALUE_TYPE, SingleNodeModel, 300>::update_cbow(*this, words, begin, end, half_window, lr, update_wc);
+        default:
+            return OneSampleKernel<VALUE_TYPE, SingleNodeModel>::update_cbow(*this, words, begin, end, half_window, lr, update_wc);
+        }
+    }
+
     virtual void incr_word_count(uint32_t word)
     {
         word_count[word]++;
     }
     virtual void add_vector_to_wi(const Vector<VALUE_TYPE> &vec, uint32_t word, float a)
     {
-        wi_[word].add(vec, a);
+        wi_.row(word).add(vec.get_val().data(), a);
     }
     virtual void add_vector_to_wo(const Vector<VALUE_TYPE> &vec, uint32_t word, float a)
     {
-        wo_[word].add(vec, a);
+        wo_.row(word).add(vec.get_val().data(), a);
     }
     virtual uint32_t getNegative(uint32_t target)
     {
         while (true)
         {
-            uint32_t i = (uint32_t)(sparc::myrand::uniform<double>() * num_word);
+            uint32_t i = sampler.sample();
             if (i != target)
             {
                 return i;
             }
         }
     }
-    virtual Vector<VALUE_TYPE> get_vec_from_wi(uint32_t word)
+    // 16-bit rows are converted into a buffer of the calling thread
+    virtual VectorView<VALUE_TYPE> get_vec_from_wi(uint32_t word)
     {
-        return wi_.at(word);
+        thread_local std::vector<VALUE_TYPE> buf;
+        return to_value_type(wi_.row(word), buf);
     }
-    virtual Vector<VALUE_TYPE> get_vec_from_wo(uint32_t word)
+    virtual VectorView<VALUE_TYPE> get_vec_from_wo(uint32_t word)
     {
-        return wo_.at(word);
+        thread_local std::vector<VALUE_TYPE> buf;
+        return to_value_type(wo_.row(word), buf);
+    }
+
+    static VectorView<VALUE_TYPE> to_value_type(const VectorView<STORAGE_TYPE> &row, std::vector<VALUE_TYPE> &buf)
+    {
+        if constexpr (std::is_same<VALUE_TYPE, STORAGE_TYPE>::value)
+        {
+            return row;
+        }
+        else
+        {
+            buf.resize(row.get_dim());
+            for (uint32_t i = 0; i < row.get_dim(); i++)
+            {
+                buf[i] = (float)row[i];
+            }
+            return VectorView<VALUE_TYPE>(buf.data(), row.get_dim());
+        }
     }
 };
 
-template <typename VALUE_TYPE>
-void write(bitsery::OutputStreamAdapter &bw, const SingleNodeModel<VALUE_TYPE> &obj)
+template <typename VALUE_TYPE, typename STORAGE_TYPE>
+void write(bitsery::OutputStreamAdapter &bw, const SingleNodeModel<VALUE_TYPE, STORAGE_TYPE> &obj)
 {
     obj.write_me(bw);
 }
@@ -9,10 +9,12 @@
 #define SOURCE_DIRECTORY__SRC_SPARC_MODEL_UPCXX_H_
 
 #include <vector>
+#include <algorithm>
 #include <cmath>
 #include <iomanip>
 #include "lru_cache/dynamic_lru_cache.h"
 #include "model.h"
+#include "upcxx_comp.h"
 
 template <>
 struct upcxx::serialization<Vector<float>>
@@ -66,12 +68,17 @@ protected:
     uint32_t bucket = 0;
     lru_cache::DynamicLruCache<uint32_t, Vector<VALUE_TYPE>> cache1;
     lru_cache::DynamicLruCache<uint32_t, Vector<VALUE_TYPE>> cache2;
+    // rows fetched from other ranks, get_vec_from_* return views of these
+    Vector<VALUE_TYPE> fetched_wi;
+    Vector<VALUE_TYPE> fetched_wo;
+    NegativeSampler sampler;
+    std::vector<uint32_t> node_rows; // the wo_ row of every inner node of the tree
 
 public:
     UPCXXModel(uint32_t total_num_word, uint32_t this_rank, uint32_t num_rank, uint32_t dim, uint32_t neg_size, bool use_cbow, uint32_t half_window)
         : Model<VALUE_TYPE>(dim, neg_size, use_cbow, half_window), 
         total_num_word(total_num_word), num_rank(num_rank), this_rank(this_rank), local_model(0),
-        cache1(1024), cache2(1024)
+        cache1(1024), cache2(1024), sampler(total_num_word)
     {
         bucket_start = new uint32_t[num_rank];
         bucket_end = new uint32_t[num_rank];
@@ -165,6 +172,63 @@ public:
         model->uniform_init();
     }
 
+    /*
+     * Collective. Every rank sums the counts of all partitions and builds
+     * the same unigram table, so drawing a negative stays local and O(1).
+     * The table only keeps the buckets that were seen.
+     */
+    bool build_unigram_sampler(double power = 0.75)
+    {
+        return sampler.build_unigram(gather_word_count(), power);
+    }
+
+    /*
+     * Collective. Every rank builds the same Huffman tree from the summed
+     * counts, and the same rows for its inner nodes. Every path starts at
+     * the root, so the nodes are dealt round-robin over the partitions
+     * (node j to rank j % num_rank, skipping full partitions) rather than
+     * taking the first rows of wo_, which would all be on rank 0. The
+     * root itself is still one rank's row. Each rank zeroes its own.
+     */
+    bool build_huffman_tree()
+    {
+        bool built = this->tree.build(gather_word_count());
+        node_rows.clear();
+        if (built)
+        {
+            std::vector<uint32_t> used(num_rank, 0);
+            uint32_t r = 0;
+            for (uint32_t j = 0; j < this->tree.num_nodes(); j++, r = (r + 1) % num_rank)
+            {
+                while (bucket_start[r] + used[r] >= bucket_end[r])
+                {
+                    r = (r + 1) % num_rank;
+                }
+                uint32_t row = bucket_start[r] + used[r]++;
+                node_rows.push_back(row);
+                model->zero_wo(row, row + 1);
+            }
+        }
+        upcxx::barrier();
+        return built;
+    }
+
+    // collective, the counts of all partitions indexed by bucket
+    std::vector<uint32_t> gather_word_count()
+    {
+        std::vector<uint32_t> local(total_num_word, 0);
+        std::vector<uint32_t> global(total_num_word, 0);
+        const std::vector<uint32_t> &wc = model->get_word_count();
+        std::copy(wc.begin(), wc.end(), local.begin() + model->get_word_start());
+        upcxx_reduce_all(local.data(), global.data(), total_num_word, upcxx_op_add).wait();
+        return global;
+    }
+
+    const NegativeSampler &get_sampler() const
+    {
+        return sampler;
+    }
+
     void dump_vector_bin(const std::string &prefix, bool zip_output)
     {
         std::string filepath = prefix;
@@ -326,20 +390,24 @@ protected:
     {
         while (true)
         {
-            uint32_t i = (uint32_t)(sparc::myrand::uniform<double>() * total_num_word);
+            uint32_t i = sampler.sample();
             if (i != target)
             {
                 return i;
             }
         }
     }
+    virtual uint32_t node_row(uint32_t node)
+    {
+        return node_rows[node];
+    }
     upcxx::future<Vector<VALUE_TYPE>> upcxx_get_vec_from_wi(uint32_t word)
     {
         return upcxx::rpc(
             get_target_rank(word),
             [](dobj_node_model_t &lmodel, uint32_t word)
             {
-                return (*lmodel)->get_vec_from_wi(word);
+                return Vector<VALUE_TYPE>((*lmodel)->get_vec_from_wi(word));
             },
             *local_model, word);
     }
@@ -349,39 +417,21 @@ protected:
             get_target_rank(word),
             [](dobj_node_model_t &lmodel, uint32_t word)
             {
-                return (*lmodel)->get_vec_from_wo(word);
+                return Vector<VALUE_TYPE>((*lmodel)->get_vec_from_wo(word));
             },
             *local_model, word);
     }
 
-    Vector<VALUE_TYPE> get_vec_from_wo(uint32_t word)
+    VectorView<VALUE_TYPE> get_vec_from_wo(uint32_t word)
     {
-        return upcxx_get_vec_from_wo(word).wait();
-        if (cache1.contains(word))
-        {
-            return cache1.get(word);
-        }
-        else
-        {
-            auto v = upcxx_get_vec_from_wo(word).wait();
-            cache1.insert(word, v);
-            return v;
-        }
+        fetched_wo = upcxx_get_vec_from_wo(word).wait();
+        return fetched_wo.view();
     }
 
-    Vector<VALUE_TYPE> get_vec_from_wi(uint32_t word)
+    VectorView<VALUE_TYPE> get_vec_from_wi(uint32_t word)
     {
-        return  upcxx_get_vec_from_wi(word).wait();
-        if (cache2.contains(word))
-        {
-            return cache2.get(word);
-        }
-        else
-        {
-            auto v = upcxx_get_vec_from_wi(word).wait();
-            cache2.insert(word, v);
-            return v;
-        }
+        fetched_wi = upcxx_get_vec_from_wi(word).wait();
+        return fetched_wi.view();
     }
 };
 
@@ -393,8 +443,8 @@ protected:
     uint32_t word_start; //include
     uint32_t word_end;   //exclude
     uint32_t num_word;
-    std::vector<Vector<VALUE_TYPE>> wo_;
-    std::vector<Vector<VALUE_TYPE>> wi_;
+    Matrix<VALUE_TYPE> wo_;
+    Matrix<VALUE_TYPE> wi_;
     std::vector<uint32_t> word_count;
 
 public:
@@ -423,10 +473,7 @@ public:
     template <typename OS>
     void write_vec(OS &output)
     {
-        for (auto &x : wi_)
-        {
-            x.write_me(output);
-        }
+        wi_.write_text(output);
     }
 
     template <typename OS>
@@ -443,6 +490,25 @@ public:
         write(bw, wi_);
     }
 
+    const std::vector<uint32_t> &get_word_count() const
+    {
+        return word_count;
+    }
+
+    uint32_t get_word_start() const
+    {
+        return word_start;
+    }
+
+    // the wo_ rows of the words in [begin, end) that are in this partition
+    void zero_wo(uint32_t begin, uint32_t end)
+    {
+        for (uint32_t w = std::max(begin, word_start); w < std::min(end, word_end); w++)
+        {
+            wo_.row(w - word_start).fill(0);
+        }
+    }
+
 public:
     UPCXXNodeModel() : Model<VALUE_TYPE>()
     {
@@ -451,11 +517,8 @@ public:
         : Model<VALUE_TYPE>(dim, neg_size, use_cbow, half_window), total_num_word(total_num_word), word_start(word_start), word_end(word_end)
     {
         num_word = word_end - word_start;
-        for (uint32_t i = 0; i < num_word; i++)
-        {
-            wo_.push_back(Vector<VALUE_TYPE>(dim));
-            wi_.push_back(Vector<VALUE_TYPE>(dim));
-        }
+        wo_.allocate(num_word, dim);
+        wi_.allocate(num_word, dim);
         word_count.resize(num_word);
     }
 
@@ -463,17 +526,18 @@ public:
     {
         for (uint32_t i = 0; i < num_word; i++)
         {
-            wo_[i].randomize();
-            wi_[i].randomize();
+            wo_.row(i).randomize();
+            wi_.row(i).randomize();
         }
     }
 
     void uniform_init()
     {
+        float x = 1.0 / this->dim;
         for (uint32_t i = 0; i < num_word; i++)
         {
-            wo_[i].uniform();
-            wi_[i].uniform();
+            wo_.row(i).fill(x);
+            wi_.row(i).fill(x);
         }
     }
 
@@ -484,30 +548,30 @@ public:
     }
     virtual void add_vector_to_wi(const Vector<VALUE_TYPE> &vec, uint32_t word, float a)
     {
-        wi_[word - word_start].add(vec, a);
+        wi_.row(word - word_start).add(vec.get_val().data(), a);
     }
     virtual void add_vector_to_wo(const Vector<VALUE_TYPE> &vec, uint32_t word, float a)
     {
-        wo_[word - word_start].add(vec, a);
+        wo_.row(word - word_start).add(vec.get_val().data(), a);
     }
     virtual uint32_t getNegative(uint32_t target)
     {
         while (true)
         {
-            uint32_t i = (uint32_t)(sparc::myrand::uniform<double>() * total_num_word);
+            uint32_t i = sparc::myrand::uniform_int(total_num_word);
             if (i != target)
             {
                 return i;
             }
         }
     }
-    virtual Vector<VALUE_TYPE> get_vec_from_wi(uint32_t word)
+    virtual VectorView<VALUE_TYPE> get_vec_from_wi(uint32_t word)
     {
-        return wi_.at(word - word_start);
+        return wi_.row(word - word_start);
     }
-    virtual Vector<VALUE_TYPE> get_vec_from_wo(uint32_t word)
+    virtual VectorView<VALUE_TYPE> get_vec_from_wo(uint32_t word)
     {
-        return wo_.at(word - word_start);
+        return wo_.row(word - word_start);
     }
 };
 
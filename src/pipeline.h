@@ -0,0 +1,173 @@
+/*
+ * pipeline.h
+ *
+ *  Producer/consumer stages for reading input while training runs. Gzip
+ *  input is decompressed on a thread of its own (AsyncIStream) and parsed
+ *  on another (PipelinedReader in io.h), connected by bounded queues,
+ *  so the OpenMP workers only wait when the input really is the
+ *  bottleneck.
+ */
+
+#ifndef SOURCE_DIRECTORY__SRC_SPARC_PIPELINE_H_
+#define SOURCE_DIRECTORY__SRC_SPARC_PIPELINE_H_
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <exception>
+#include <memory>
+#include <istream>
+#include <vector>
+
+/*
+ * Blocking FIFO with a fixed capacity. close() wakes everyone up: push then
+ * fails, pop drains what is left and then fails.
+ */
+template <typename T>
+class BoundedQueue
+{
+protected:
+    std::mutex mtx;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1)
+    {
+    }
+
+    bool push(T &&x)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        not_full.wait(lock, [this]
+                      { return closed || items.size() < capacity; });
+        if (closed)
+        {
+            return false;
+        }
+        items.push_back(std::move(x));
+        not_empty.notify_one();
+        return true;
+    }
+
+    bool pop(T &x)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        not_empty.wait(lock, [this]
+                       { return closed || !items.empty(); });
+        if (items.empty())
+        {
+            return false;
+        }
+        x = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        closed = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+};
+
+/*
+ * istream that reads its source (e.g. an igzstream) on a thread of its own,
+ * chunk_size bytes at a time with up to depth chunks ahead, so the reader
+ * parses while the next chunk is being decompressed.
+ */
+class AsyncIStream : public std::istream
+{
+protected:
+    class Buf : public std::streambuf
+    {
+    public:
+        std::unique_ptr<std::istream> source;
+        BoundedQueue<std::vector<char>> chunks;
+        std::vector<char> current;
+        std::exception_ptr error;
+        std::thread worker;
+
+        Buf(std::unique_ptr<std::istream> source, size_t chunk_size, size_t depth)
+            : source(std::move(source)), chunks(depth)
+        {
+            worker = std::thread([this, chunk_size]
+                                 { run(chunk_size); });
+        }
+
+        ~Buf()
+        {
+            chunks.close();
+            worker.join();
+        }
+
+        void run(size_t chunk_size)
+        {
+            try
+            {
+                while (true)
+                {
+                    std::vector<char> chunk(chunk_size);
+                    source->read(chunk.data(), chunk_size);
+                    size_t n = (size_t)source->gcount();
+                    if (n == 0)
+                    {
+                        break;
+                    }
+                    chunk.resize(n);
+                    if (!chunks.push(std::move(chunk)))
+                    {
+                        break;
+                    }
+                }
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            chunks.close();
+        }
+
+    protected:
+        int_type underflow() override
+        {
+            if (gptr() < egptr())
+            {
+                return traits_type::to_int_type(*gptr());
+            }
+            if (!chunks.pop(current))
+            {
+                return traits_type::eof();
+            }
+            setg(current.data(), current.data(), current.data() + current.size());
+            return traits_type::to_int_type(*gptr());
+        }
+    };
+
+    Buf buf;
+
+public:
+    AsyncIStream(std::unique_ptr<std::istream> source, size_t chunk_size = 1 << 20, size_t depth = 4)
+        : std::istream(nullptr), buf(std::move(source), chunk_size, depth)
+    {
+        rdbuf(&buf);
+    }
+
+    // an error of the source shows up as end of input, this rethrows it
+    void rethrow_if_failed()
+    {
+        if (buf.error)
+        {
+            std::rethrow_exception(buf.error);
+        }
+    }
+};
+
+#endif /* SOURCE_DIRECTORY__SRC_SPARC_PIPELINE_H_ */
@@ -0,0 +1,226 @@
+#include <memory>
+#include "argagg.hpp"
+#include "utils.h"
+#include "CRandProj.h"
+#include "kmer.h"
+#include "io.h"
+#include "corpus.h"
+#include "seqreader.h"
+#include "config.h"
+#include "pbar.h"
+#include "ProjConfig.h"
+
+struct Config : public BaseConfig
+{
+    uint32_t hash_block;
+    size_t mem_budget;
+    std::string hash_file;
+    std::string output_path;
+    bool is_fasta = false;
+    bool is_fastq = false;
+    bool bit_pack = false;
+
+    SeqFormat seq_format() const
+    {
+        return is_fasta ? SeqFormat::FASTA : (is_fastq ? SeqFormat::FASTQ : SeqFormat::LINE);
+    }
+
+    void print()
+    {
+        BaseConfig::print();
+        myinfo("config: hash_file=%s", hash_file.c_str());
+        myinfo("config: hash_block=%ld", hash_block);
+        myinfo("config: output_path=%s", output_path.c_str());
+        myinfo("config: bit_pack=%s", bit_pack ? "true" : "false");
+        myinfo("config: mem_budget=%luMB", mem_budget >> 20);
+    }
+};
+
+void show_help(const char *prog, argagg::parser &argparser)
+{
+    std::cout << prog << " v" << PROJECT_VERSION << "\n";
+
+    std::cout << "Usage: " << prog << " [options] file1, file2 ....\n";
+    std::cout << "Allowed options:\n";
+    std::cout << argparser;
+}
+
+void run(Config &);
+
+int main(int argc, char **argv)
+{
+    Config config;
+    config.program = argv[0];
+    config.rank = 0;
+    config.mpi_hostname = sparc::get_hostname();
+    set_spdlog_pattern(config.mpi_hostname.c_str(), config.rank);
+
+    const char *program = argv[0];
+    argagg::parser argparser{{
+
+        {"help", {"-h", "--help"}, "shows this help message", 0},
+
+        {"use_fasta", {"--fasta"}, "input are fasta files", 0},
+        {"use_fastq", {"--fastq"}, "input are fastq files", 0},
+        {"bit_pack", {"--bit-pack"}, "store bucket ids with hash_size bits instead of 32", 0},
+
+        {"output", {"-o", "--output"}, "output corpus file (default 'corpus.bin')", 1},
+        {"hash_file", {"--hash-file"}, "hash file to use", 1},
+        {"hash_block", {
+                           "--hash-block",
+                       },
+         "bases per hash table lookup, 1-4 (default 1 which is exact, larger is faster but may rarely change a bucket)",
+         1},
+        {"mem_budget", {
+                           "--mem-budget",
+                       },
+         "MB of bucket ids kept in memory while reading, the rest goes to a temporary file (default 4096)",
+         1},
+        {"n_thread", {
+                         "--thread",
+                     },
+         "thread to use (default 0)",
+         1},
+
+    }};
+
+    argagg::parser_results args;
+    try
+    {
+        args = argparser.parse(argc, argv);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        show_help(program, argparser);
+        return EXIT_FAILURE;
+    }
+
+    if (args["help"])
+    {
+        show_help(program, argparser);
+        return EXIT_SUCCESS;
+    }
+
+    for (auto x : {"hash_file"})
+        if (!args[x])
+        {
+            std::cerr << "ERROR: " << x << " is not set.\n";
+            show_help(program, argparser);
+            return EXIT_FAILURE;
+        }
+    config.nprocs = args["n_thread"].as<uint32_t>(0);
+    if (config.nprocs == 0)
+    {
+        config.nprocs = sparc::get_number_of_thread();
+    }
+    config.backend = "smp";
+    config.hash_block = args["hash_block"].as<uint32_t>(1);
+    config.mem_budget = args["mem_budget"].as<size_t>(4096) << 20;
+    config.is_fasta = args["use_fasta"];
+    config.is_fastq = args["use_fastq"];
+    config.bit_pack = args["bit_pack"];
+    config.hash_file = args["hash_file"].as<std::string>();
+
+    if (!sparc::file_exists(config.hash_file.c_str()))
+    {
+        std::cerr << "hash file does not exists: " << config.hash_file << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (args.pos.empty())
+    {
+        std::cerr << "no input files are provided" << std::endl;
+        return EXIT_FAILURE;
+    }
+    else
+    {
+        config.inputpath = args.all_as<std::string>();
+        bool b_error = false;
+        for (size_t i = 0; i < config.inputpath.size(); i++)
+        {
+            if (!sparc::file_exists(config.inputpath.at(i).c_str()))
+            {
+                std::cerr << "Error, input file does not exists:  "
+                          << config.inputpath.at(i) << std::endl;
+                b_error = true;
+            }
+        }
+        if (b_error)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    config.output_path = args["output"].as<std::string>("corpus.bin");
+    config.print();
+
+    run(config);
+
+    return 0;
+}
+
+// reads are appended in input order, so transform output lines up with the input
+template <class BR>
+void run(Config &config, BR &reader, rpns::CRandProj &hash, HashedCorpus &corpus)
+{
+    uint32_t batchsize = config.nprocs * 100;
+    PUnknownBar ubar("prehash:");
+    while (true)
+    {
+        SeqBatch v = reader.next(batchsize);
+        if (v.empty())
+        {
+            break;
+        }
+
+        std::vector<std::vector<uint32_t>> kmers(v.size());
+#pragma omp parallel for
+        for (size_t i = 0; i < v.size(); i++)
+        {
+            std::string_view seq = v.at(i).seq;
+
+            hash.hash_seq(seq, kmers[i]);
+            ubar.tick();
+        }
+        for (auto &x : kmers)
+        {
+            corpus.append(x.data(), x.size());
+        }
+    }
+    ubar.end();
+}
+
+void run(Config &config)
+{
+    omp_set_num_threads(config.nprocs);
+    rpns::CRandProj hash;
+    if (hash.load(config.hash_file) != 0)
+    {
+        myerror("load rp hash failed: %s", config.hash_file.c_str());
+        exit(EXIT_FAILURE);
+    }
+    if (config.hash_block != 1 && hash.compile(config.hash_block) != 0)
+    {
+        myerror("failed to compile hash with hash_block=%u", config.hash_block);
+        exit(EXIT_FAILURE);
+    }
+
+    try
+    {
+        HashedCorpus corpus(config.mem_budget, config.output_path + ".tmp");
+        PipelinedSeqReader reader(ChunkedBatchReader(config.inputpath, config.seq_format()));
+        run(config, reader, hash, corpus);
+        corpus.finish();
+        myinfo("hashed %lu reads, %lu tokens", corpus.num_reads(), corpus.num_tokens());
+
+        corpus.save(config.output_path, hash.get_kmer_size(), hash.get_hash_size(), config.hash_block,
+                    HashedCorpus::checksum_file(config.hash_file), config.bit_pack);
+    }
+    catch (const std::exception &e)
+    {
+        myerror("%s", e.what());
+        exit(EXIT_FAILURE);
+    }
+    myinfo("corpus written to %s", config.output_path.c_str());
+}
@@ -0,0 +1,302 @@
+/*
+ * sampler.h
+ *
+ *  Negative samplers and frequent-bucket subsampling for training.
+ */
+
+#ifndef SOURCE_DIRECTORY__SRC_SPARC_SAMPLER_H_
+#define SOURCE_DIRECTORY__SRC_SPARC_SAMPLER_H_
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include "utils.h"
+
+/*
+ * Walker's alias table over a discrete distribution, O(1) per draw (one
+ * uniform bucket plus one biased coin).
+ */
+class AliasTable
+{
+protected:
+    std::vector<float> prob;
+    std::vector<uint32_t> alias;
+
+public:
+    // weights need not be normalized, at least one must be positive
+    void build(const std::vector<double> &weights)
+    {
+        size_t n = weights.size();
+        double total = 0;
+        for (double w : weights)
+        {
+            total += w;
+        }
+        if (n == 0 || !(total > 0))
+        {
+            throw std::runtime_error("alias table needs a positive weight");
+        }
+        prob.assign(n, 1.0f);
+        alias.resize(n);
+        std::vector<double> scaled(n);
+        std::vector<uint32_t> small, large;
+        for (size_t i = 0; i < n; i++)
+        {
+            alias[i] = (uint32_t)i;
+            scaled[i] = weights[i] * n / total;
+            if (scaled[i] < 1.0)
+            {
+                small.push_back((uint32_t)i);
+            }
+            else
+            {
+                large.push_back((uint32_t)i);
+            }
+        }
+        while (!small.empty() && !large.empty())
+        {
+            uint32_t s = small.back(), l = large.back();
+            small.pop_back();
+            prob[s] = (float)scaled[s];
+            alias[s] = l;
+            scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+            if (scaled[l] < 1.0)
+            {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // whatever is left is 1 up to rounding and keeps prob=1
+    }
+
+    inline uint32_t sample() const
+    {
+        uint32_t i = sparc::myrand::uniform_int((uint32_t)prob.size());
+        return sparc::myrand::uniform<float>() < prob[i] ? i : alias[i];
+    }
+
+    size_t size() const
+    {
+        return prob.size();
+    }
+
+    bool empty() const
+    {
+        return prob.empty();
+    }
+};
+
+/*
+ * Draws negative buckets. Until a unigram table is built it draws
+ * uniformly from [0, num_word). build_unigram() switches to the word2vec
+ * distribution count^power over the buckets that were seen at least once,
+ * so the negatives are no longer spent on empty buckets.
+ */
+class NegativeSampler
+{
+public:
+    enum Kind
+    {
+        UNIFORM = 0,
+        UNIGRAM = 1
+    };
+
+protected:
+    Kind kind = UNIFORM;
+    uint32_t num_word = 0;
+    AliasTable table;
+    std::vector<uint32_t> words; // table index -> bucket
+
+public:
+    NegativeSampler()
+    {
+    }
+
+    NegativeSampler(uint32_t num_word) : num_word(num_word)
+    {
+    }
+
+    Kind get_kind() const
+    {
+        return kind;
+    }
+
+    // number of buckets the unigram table draws from
+    size_t support() const
+    {
+        return kind == UNIGRAM ? words.size() : num_word;
+    }
+
+    void set_uniform(uint32_t num_word)
+    {
+        this->num_word = num_word;
+        kind = UNIFORM;
+        words.clear();
+        table = AliasTable();
+    }
+
+    /*
+     * counts[i] is the count of bucket i (offset by first_word). Returns
+     * false and stays uniform if fewer than two buckets were seen, since
+     * then a negative different from the target may not exist.
+     */
+    bool build_unigram(const std::vector<uint32_t> &counts, double power = 0.75, uint32_t first_word = 0)
+    {
+        std::vector<uint32_t> seen;
+        std::vector<double> weights;
+        for (size_t i = 0; i < counts.size(); i++)
+        {
+            if (counts[i] > 0)
+            {
+                seen.push_back((uint32_t)i + first_word);
+                weights.push_back(std::pow((double)counts[i], power));
+            }
+        }
+        if (seen.size() < 2)
+        {
+            return false;
+        }
+        table.build(weights);
+        words.swap(seen);
+        kind = UNIGRAM;
+        return true;
+    }
+
+    inline uint32_t sample() const
+    {
+        if (kind == UNIGRAM)
+        {
+            return words[table.sample()];
+        }
+        return sparc::myrand::uniform_int(num_word);
+    }
+
+    // read the "bucket count" lines written by save_wordcounts
+    static std::vector<uint32_t> read_word_counts(const std::string &path, uint32_t num_word)
+    {
+        std::ifstream input(path);
+        if (!input)
+        {
+            throw std::runtime_error("can not open word count file: " + path);
+        }
+        std::vector<uint32_t> counts(num_word, 0);
+        std::string line;
+        while (std::getline(input, line))
+        {
+            std::istringstream ss(line);
+            uint64_t word, count;
+            if (!(ss >> word >> count))
+            {
+                continue;
+            }
+            if (word >= num_word)
+            {
+                throw std::runtime_error("word count file does not match the hash: " + path);
+            }
+            counts[word] = (uint32_t)count;
+        }
+        return counts;
+    }
+};
+
+/*
+ * Drops tokens of frequent buckets before they reach Model::update, the
+ * word2vec/fastText subsampling: a bucket with frequency f is kept with
+ * probability sqrt(t/f) + t/f. Until built every token is kept.
+ */
+class Subsampler
+{
+protected:
+    double threshold = 0;
+    std::vector<float> keep_prob; // by bucket, empty keeps everything
+
+public:
+    Subsampler()
+    {
+    }
+
+    Subsampler(double threshold) : threshold(threshold)
+    {
+    }
+
+    bool enabled() const
+    {
+        return !keep_prob.empty();
+    }
+
+    // counts indexed by bucket. Returns false if there is nothing to drop.
+    bool build(const std::vector<uint32_t> &counts)
+    {
+        keep_prob.clear();
+        if (!(threshold > 0))
+        {
+            return false;
+        }
+        double total = 0;
+        for (uint32_t c : counts)
+        {
+            total += c;
+        }
+        if (!(total > 0))
+        {
+            return false;
+        }
+        keep_prob.assign(counts.size(), 1.0f);
+        for (size_t i = 0; i < counts.size(); i++)
+        {
+            if (counts[i] > 0)
+            {
+                double r = threshold * total / counts[i];
+                keep_prob[i] = (float)std::min(1.0, std::sqrt(r) + r);
+            }
+        }
+        return true;
+    }
+
+    // expected fraction of the tokens kept, given the counts passed to build
+    double kept_fraction(const std::vector<uint32_t> &counts) const
+    {
+        if (!enabled())
+        {
+            return 1;
+        }
+        double total = 0, kept = 0;
+        for (size_t i = 0; i < counts.size() && i < keep_prob.size(); i++)
+        {
+            total += counts[i];
+            kept += counts[i] * (double)keep_prob[i];
+        }
+        return total > 0 ? kept / total : 1;
+    }
+
+    inline bool keep(uint32_t word) const
+    {
+        float p = keep_prob[word];
+        return p >= 1.0f || sparc::myrand::uniform<float>() < p;
+    }
+
+    // removes the dropped tokens in place, returns how many are left
+    size_t filter(std::vector<uint32_t> &words) const
+    {
+        if (!enabled())
+        {
+            return words.size();
+        }
+        size_t n = 0;
+        for (size_t i = 0; i < words.size(); i++)
+        {
+            if (keep(words[i]))
+            {
+                words[n++] = words[i];
+            }
+        }
+        words.resize(n);
+        return n;
+    }
+};
+
+#endif /* SOURCE_DIRECTORY__SRC_SPARC_SAMPLER_H_ */
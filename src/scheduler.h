@@ -0,0 +1,150 @@
+/*
+ * scheduler.h
+ *
+ *  Work stealing over weighted work items for the OpenMP training loops,
+ *  with per-thread utilization accounting.
+ */
+
+#ifndef SOURCE_DIRECTORY__SRC_SPARC_SCHEDULER_H_
+#define SOURCE_DIRECTORY__SRC_SPARC_SCHEDULER_H_
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <omp.h>
+
+/*
+ * Every thread starts with a contiguous range of the items of about the
+ * same total weight, takes items from its front, and when it runs out
+ * steals the back half of the range of another thread. The weights only
+ * decide the initial split, stealing evens out whatever they got wrong.
+ */
+class WorkStealingScheduler
+{
+protected:
+    struct Range
+    {
+        std::mutex mtx;
+        size_t front = 0;
+        size_t back = 0;
+    };
+
+    std::vector<std::unique_ptr<Range>> ranges;
+    std::vector<double> busy; // seconds each thread had work
+    double wall = 0;          // seconds in run()
+
+public:
+    WorkStealingScheduler(int num_threads = omp_get_max_threads())
+    {
+        num_threads = std::max(num_threads, 1);
+        for (int i = 0; i < num_threads; i++)
+        {
+            ranges.emplace_back(new Range());
+        }
+        busy.assign(num_threads, 0);
+    }
+
+    int num_threads() const
+    {
+        return (int)ranges.size();
+    }
+
+    // calls work(item) for every item, from num_threads() threads
+    template <typename F>
+    void run(const std::vector<size_t> &weights, F &&work)
+    {
+        size_t n = weights.size();
+        size_t nt = ranges.size();
+        double total = 0;
+        for (size_t w : weights)
+        {
+            total += w;
+        }
+        double acc = 0;
+        size_t i = 0;
+        for (size_t t = 0; t < nt; t++)
+        {
+            ranges[t]->front = i;
+            while (i < n && acc + weights[i] / 2.0 < total * (t + 1) / nt)
+            {
+                acc += weights[i++];
+            }
+            ranges[t]->back = t + 1 == nt ? n : i;
+        }
+
+        double start = omp_get_wtime();
+#pragma omp parallel num_threads(nt)
+        {
+            int tid = omp_get_thread_num();
+            double t0 = omp_get_wtime();
+            size_t item;
+            while (pop(tid, item) || steal(tid, item))
+            {
+                work(item);
+            }
+            busy[tid] += omp_get_wtime() - t0;
+        }
+        wall += omp_get_wtime() - start;
+    }
+
+    void reset_utilization()
+    {
+        std::fill(busy.begin(), busy.end(), 0);
+        wall = 0;
+    }
+
+    // busy time of every thread as a percentage of the time in run()
+    std::vector<double> utilization() const
+    {
+        std::vector<double> ret(busy.size(), 0);
+        for (size_t i = 0; i < busy.size() && wall > 0; i++)
+        {
+            ret[i] = std::min(100.0, 100.0 * busy[i] / wall);
+        }
+        return ret;
+    }
+
+protected:
+    bool pop(int tid, size_t &item)
+    {
+        Range &r = *ranges[tid];
+        std::lock_guard<std::mutex> lock(r.mtx);
+        if (r.front >= r.back)
+        {
+            return false;
+        }
+        item = r.front++;
+        return true;
+    }
+
+    bool steal(int tid, size_t &item)
+    {
+        int nt = (int)ranges.size();
+        for (int k = 1; k < nt; k++)
+        {
+            Range &victim = *ranges[(tid + k) % nt];
+            size_t front, back;
+            {
+                std::lock_guard<std::mutex> lock(victim.mtx);
+                if (victim.front >= victim.back)
+                {
+                    continue;
+                }
+                back = victim.back;
+                front = victim.front + (victim.back - victim.front) / 2;
+                victim.back = front;
+            }
+            Range &mine = *ranges[tid];
+            std::lock_guard<std::mutex> lock(mine.mtx);
+            item = front;
+            mine.front = front + 1;
+            mine.back = back;
+            return true;
+        }
+        return false;
+    }
+};
+
+#endif /* SOURCE_DIRECTORY__SRC_SPARC_SCHEDULER_H_ */
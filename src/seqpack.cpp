@@ -0,0 +1,57 @@
+#include <cstdint>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "seqpack.h"
+
+namespace
+{
+struct NormalizeTable
+{
+    char map[256];
+
+    NormalizeTable()
+    {
+        memset(map, 'N', sizeof(map));
+        for (const char *c = "ACGT"; *c; c++)
+        {
+            map[(uint8_t)*c] = map[(uint8_t)(*c - 'A' + 'a')] = *c;
+        }
+    }
+};
+
+const NormalizeTable table;
+
+#if defined(__SSE2__)
+/*
+ * 16 bases: clearing bit 5 upper cases letters and only makes 'a'..'t'
+ * alias 'A'..'T', so four compares find ACGT.
+ */
+inline void normalize_16(char *p)
+{
+    __m128i x = _mm_loadu_si128((const __m128i *)p);
+    __m128i u = _mm_andnot_si128(_mm_set1_epi8(0x20), x);
+    __m128i ok = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(u, _mm_set1_epi8('A')), _mm_cmpeq_epi8(u, _mm_set1_epi8('C'))),
+                              _mm_or_si128(_mm_cmpeq_epi8(u, _mm_set1_epi8('G')), _mm_cmpeq_epi8(u, _mm_set1_epi8('T'))));
+    __m128i out = _mm_or_si128(_mm_and_si128(ok, u), _mm_andnot_si128(ok, _mm_set1_epi8('N')));
+    _mm_storeu_si128((__m128i *)p, out);
+}
+#endif
+} // namespace
+
+void normalize_seq(char *seq, size_t len)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= len; i += 16)
+    {
+        normalize_16(seq + i);
+    }
+#endif
+    // the tail, and everything on targets without SSE2
+    for (; i < len; i++)
+    {
+        seq[i] = table.map[(uint8_t)seq[i]];
+    }
+}
@@ -0,0 +1,16 @@
+/*
+ * seqpack.h
+ *
+ *  Sequence normalization (upper case, anything but ACGT becomes N),
+ *  done 16 bases at a time with SSE2 where available.
+ */
+
+#ifndef SOURCE_DIRECTORY__SRC_SPARC_SEQPACK_H_
+#define SOURCE_DIRECTORY__SRC_SPARC_SEQPACK_H_
+
+#include <cstddef>
+
+// in place, the same as the old per-character toupper and compare
+void normalize_seq(char *seq, size_t len);
+
+#endif /* SOURCE_DIRECTORY__SRC_SPARC_SEQPACK_H_ */
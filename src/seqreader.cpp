@@ -0,0 +1,516 @@
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "seqreader.h"
+
+namespace
+{
+inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+inline void trim(char *&b, char *&e)
+{
+    while (b < e && is_space(*b))
+    {
+        b++;
+    }
+    while (e > b && is_space(e[-1]))
+    {
+        e--;
+    }
+}
+
+inline char *find_newline(char *p, char *end)
+{
+    return (char *)memchr(p, '\n', end - p);
+}
+
+size_t parse_fasta(char *begin, char *end, bool at_eof, std::vector<SeqView> &records)
+{
+    char *p = begin;
+    while (true)
+    {
+        while (p < end && is_space(*p))
+        {
+            p++;
+        }
+        if (p >= end)
+        {
+            // only blank lines are left, they may still be part of a line
+            return at_eof ? end - begin : p - begin;
+        }
+        char *rec = p;
+        if (*p != '>')
+        {
+            throw std::runtime_error("failed to find header before sequence");
+        }
+        char *nl = find_newline(p, end);
+        if (!nl && !at_eof)
+        {
+            return rec - begin;
+        }
+        char *id_begin = p, *id_end = nl ? nl : end;
+        trim(id_begin, id_end);
+        char *seq_begin = nl ? nl + 1 : end;
+
+        // the record ends before the next line starting with '>'
+        char *rec_end = NULL;
+        p = seq_begin;
+        while (true)
+        {
+            char *q = p;
+            while (q < end && is_space(*q))
+            {
+                q++;
+            }
+            if (q >= end)
+            {
+                rec_end = at_eof ? end : NULL;
+                break;
+            }
+            if (*q == '>')
+            {
+                rec_end = p;
+                break;
+            }
+            nl = find_newline(q, end);
+            if (!nl)
+            {
+                rec_end = at_eof ? end : NULL;
+                break;
+            }
+            p = nl + 1;
+        }
+        if (!rec_end)
+        {
+            return rec - begin;
+        }
+
+        // join the lines, nothing moves for single line records
+        char *w = seq_begin;
+        for (p = seq_begin; p < rec_end;)
+        {
+            nl = find_newline(p, rec_end);
+            char *b = p, *e = nl ? nl : rec_end;
+            p = nl ? nl + 1 : rec_end;
+            trim(b, e);
+            if (b != w)
+            {
+                memmove(w, b, e - b);
+            }
+            w += e - b;
+        }
+        normalize_seq(seq_begin, w - seq_begin);
+        records.push_back({std::string_view(id_begin, id_end - id_begin), std::string_view(seq_begin, w - seq_begin)});
+        p = rec_end;
+    }
+}
+
+size_t parse_fastq(char *begin, char *end, bool at_eof, std::vector<SeqView> &records)
+{
+    char *p = begin;
+    while (true)
+    {
+        char *line_begin[4], *line_end[4];
+        int i = 0;
+        char *q = p;
+        while (i < 4 && q < end)
+        {
+            char *nl = find_newline(q, end);
+            if (!nl && !at_eof)
+            {
+                break;
+            }
+            char *b = q, *e = nl ? nl : end;
+            q = nl ? nl + 1 : end;
+            trim(b, e);
+            if (b == e)
+            {
+                continue;
+            }
+            line_begin[i] = b;
+            line_end[i] = e;
+            i++;
+        }
+        if (i < 4)
+        {
+            if (!at_eof)
+            {
+                return p - begin;
+            }
+            if (i > 0)
+            {
+                throw std::runtime_error("failed to read fastq records, not enough rows");
+            }
+            return end - begin;
+        }
+        if (line_begin[0][0] != '@' && line_begin[2][0] != '+')
+        {
+            throw std::runtime_error("failed to read fastq records");
+        }
+        normalize_seq(line_begin[1], line_end[1] - line_begin[1]);
+        records.push_back({std::string_view(line_begin[0], line_end[0] - line_begin[0]),
+                           std::string_view(line_begin[1], line_end[1] - line_begin[1])});
+        p = q;
+    }
+}
+
+size_t parse_lines(char *begin, char *end, bool at_eof, std::vector<SeqView> &records)
+{
+    static const std::string_view id(">useless");
+    char *p = begin;
+    while (p < end)
+    {
+        char *nl = find_newline(p, end);
+        if (!nl && !at_eof)
+        {
+            break;
+        }
+        char *b = p, *e = nl ? nl : end;
+        p = nl ? nl + 1 : end;
+        trim(b, e);
+        if (b == e)
+        {
+            continue;
+        }
+        normalize_seq(b, e - b);
+        records.push_back({id, std::string_view(b, e - b)});
+    }
+    return p - begin;
+}
+} // namespace
+
+// a private writable mapping of the whole file
+struct MappedInput
+{
+    char *base = NULL;
+    size_t size = 0;
+
+    ~MappedInput()
+    {
+        if (base)
+        {
+            munmap(base, size);
+        }
+    }
+};
+
+/*
+ * Owner of the records of one chunk of a mapping. Parsing dirtied these
+ * pages (copy on write), when the chunk is done they are dropped again so
+ * a large file does not end up in memory as a whole.
+ */
+struct MappedChunk
+{
+    std::shared_ptr<MappedInput> input;
+    size_t begin, end;
+
+    MappedChunk(std::shared_ptr<MappedInput> input, size_t begin, size_t end)
+        : input(input), begin(begin), end(end)
+    {
+    }
+
+    ~MappedChunk()
+    {
+        // only the pages no other chunk shares
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t b = (begin + page - 1) / page * page;
+        size_t e = end == input->size ? end : end / page * page;
+        if (b < e)
+        {
+            madvise(input->base + b, e - b, MADV_DONTNEED);
+        }
+    }
+};
+
+ChunkedSeqReader::ChunkedSeqReader(const std::string &filepath, SeqFormat format, size_t chunk_size)
+    : filepath(filepath), format(format), chunk_size(chunk_size > 0 ? chunk_size : 1)
+{
+    open(0, SIZE_MAX);
+}
+
+ChunkedSeqReader::ChunkedSeqReader(const InputShard &shard, SeqFormat format, size_t chunk_size)
+    : filepath(shard.path), format(format), chunk_size(chunk_size > 0 ? chunk_size : 1)
+{
+    open(shard.begin, shard.end);
+}
+
+void ChunkedSeqReader::open(size_t begin, size_t end)
+{
+    bool whole = begin == 0 && end == SIZE_MAX;
+    if (filepath == "-" || sparc::endswith(filepath, ".gz"))
+    {
+        if (!whole)
+        {
+            throw std::logic_error("only uncompressed files can be read in parts: " + filepath);
+        }
+        if (filepath == "-")
+        {
+            stream = &std::cin;
+            return;
+        }
+        async = new AsyncIStream(std::unique_ptr<std::istream>(new igzstream(filepath.c_str())));
+        owned_stream.reset(async);
+        stream = async;
+        return;
+    }
+    int fd = ::open(filepath.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("can not open file: " + filepath);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        // e.g. a pipe, read it as a stream
+        close(fd);
+        if (!whole)
+        {
+            throw std::logic_error("only regular files can be read in parts: " + filepath);
+        }
+        owned_stream.reset(new std::ifstream(filepath, std::ios::binary));
+        stream = owned_stream.get();
+        return;
+    }
+    mapped = std::make_shared<MappedInput>();
+    if (st.st_size > 0)
+    {
+        void *p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+        {
+            close(fd);
+            throw std::runtime_error(std::string("mmap failed: ") + filepath + ": " + strerror(errno));
+        }
+        mapped->base = (char *)p;
+        mapped->size = st.st_size;
+    }
+    close(fd);
+    cursor = record_start(mapped->base, mapped->size, begin, format);
+    limit = record_start(mapped->base, mapped->size, end, format);
+    if (cursor < limit)
+    {
+        madvise(mapped->base + cursor, limit - cursor, MADV_SEQUENTIAL);
+    }
+}
+
+ChunkedSeqReader::~ChunkedSeqReader()
+{
+}
+
+size_t ChunkedSeqReader::parse(char *begin, char *end, bool at_eof, SeqFormat format, std::vector<SeqView> &records)
+{
+    switch (format)
+    {
+    case SeqFormat::FASTA:
+        return parse_fasta(begin, end, at_eof, records);
+    case SeqFormat::FASTQ:
+        return parse_fastq(begin, end, at_eof, records);
+    default:
+        return parse_lines(begin, end, at_eof, records);
+    }
+}
+
+bool ChunkedSeqReader::next(std::vector<SeqView> &records, std::shared_ptr<const void> &owner)
+{
+    records.clear();
+    owner.reset();
+    return mapped ? next_mapped(records, owner) : next_streamed(records, owner);
+}
+
+size_t ChunkedSeqReader::record_start(const char *data, size_t size, size_t pos, SeqFormat format)
+{
+    // the first line start at or after pos
+    auto line_start = [data, size](size_t pos)
+    {
+        if (pos == 0 || pos >= size)
+        {
+            return std::min(pos, size);
+        }
+        const char *nl = (const char *)memchr(data + pos - 1, '\n', size - pos + 1);
+        return nl ? (size_t)(nl + 1 - data) : size;
+    };
+    for (pos = line_start(pos); pos < size; pos = line_start(pos + 1))
+    {
+        if (format == SeqFormat::LINE || (format == SeqFormat::FASTA && data[pos] == '>'))
+        {
+            return pos;
+        }
+        if (format == SeqFormat::FASTQ && data[pos] == '@')
+        {
+            size_t plus = line_start(line_start(pos + 1) + 1);
+            if (plus < size && data[plus] == '+')
+            {
+                return pos;
+            }
+        }
+    }
+    return size;
+}
+
+bool ChunkedSeqReader::next_mapped(std::vector<SeqView> &records, std::shared_ptr<const void> &owner)
+{
+    size_t size = limit;
+    size_t end = std::min(size, cursor + chunk_size);
+    while (cursor < size)
+    {
+        size_t n = parse(mapped->base + cursor, mapped->base + end, end == size, format, records);
+        if (records.empty() && end < size)
+        {
+            // no complete record yet, nothing was touched
+            end = std::min(size, cursor + 2 * (end - cursor));
+            continue;
+        }
+        owner = std::make_shared<MappedChunk>(mapped, cursor, cursor + n);
+        cursor += n;
+        return !records.empty();
+    }
+    return false;
+}
+
+size_t ChunkedSeqReader::read_some(char *buf, size_t n)
+{
+    stream->read(buf, n);
+    size_t got = (size_t)stream->gcount();
+    if (got < n)
+    {
+        if (async)
+        {
+            async->rethrow_if_failed();
+        }
+        if (stream->bad())
+        {
+            throw std::runtime_error("read failed: " + filepath);
+        }
+    }
+    return got;
+}
+
+bool ChunkedSeqReader::next_streamed(std::vector<SeqView> &records, std::shared_ptr<const void> &owner)
+{
+    auto buf = std::make_shared<std::vector<char>>(std::move(tail));
+    tail.clear();
+    size_t n = 0;
+    while (true)
+    {
+        if (!stream_eof)
+        {
+            // double the buffer while a record does not fit
+            size_t want = std::max(chunk_size, buf->size());
+            size_t old = buf->size();
+            buf->resize(old + want);
+            size_t got = read_some(buf->data() + old, want);
+            buf->resize(old + got);
+            stream_eof = got < want;
+        }
+        n = parse(buf->data(), buf->data() + buf->size(), stream_eof, format, records);
+        if (!records.empty() || stream_eof)
+        {
+            break;
+        }
+    }
+    tail.assign(buf->begin() + n, buf->end());
+    owner = buf;
+    return !records.empty();
+}
+
+ChunkedBatchReader::ChunkedBatchReader(const std::vector<std::string> &files, SeqFormat format, size_t chunk_size)
+    : files(files), format(format), chunk_size(chunk_size)
+{
+    for (auto &file : files)
+    {
+        if (file != "-" && !sparc::file_exists(file.c_str()))
+        {
+            throw std::runtime_error(std::string("file not found: ") + file);
+        }
+    }
+}
+
+bool ChunkedBatchReader::next_chunk()
+{
+    chunk_pos = 0;
+    while (curr_file_index < files.size())
+    {
+        if (!reader)
+        {
+            reader.reset(new ChunkedSeqReader(files.at(curr_file_index), format, chunk_size));
+        }
+        if (reader->next(chunk, chunk_owner))
+        {
+            return true;
+        }
+        reader.reset();
+        curr_file_index++;
+    }
+    chunk.clear();
+    chunk_owner.reset();
+    return false;
+}
+
+SeqBatch ChunkedBatchReader::next(size_t batch_size)
+{
+    SeqBatch batch;
+    while (batch.size() < batch_size)
+    {
+        if (chunk_pos >= chunk.size() && !next_chunk())
+        {
+            break;
+        }
+        size_t n = std::min(batch_size - batch.size(), chunk.size() - chunk_pos);
+        batch.insert(batch.end(), chunk.begin() + chunk_pos, chunk.begin() + chunk_pos + n);
+        batch.owners.push_back(chunk_owner);
+        chunk_pos += n;
+    }
+    return batch;
+}
+
+static bool is_splittable(const std::string &file, size_t &size)
+{
+    struct stat st;
+    if (file == "-" || sparc::endswith(file, ".gz") || stat(file.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        return false;
+    }
+    size = st.st_size;
+    return true;
+}
+
+std::vector<InputShard> make_shards(const std::vector<std::string> &files, size_t parts, size_t min_bytes)
+{
+    size_t total = 0, size;
+    for (auto &file : files)
+    {
+        if (is_splittable(file, size))
+        {
+            total += size;
+        }
+    }
+    size_t shard_bytes = std::max(min_bytes, total / std::max<size_t>(parts, 1));
+
+    std::vector<InputShard> shards;
+    for (auto &file : files)
+    {
+        InputShard shard;
+        shard.path = file;
+        if (!is_splittable(file, size))
+        {
+            shards.push_back(shard);
+            continue;
+        }
+        // the readers move the boundaries to record starts
+        size_t n = std::max<size_t>(1, (size + shard_bytes - 1) / std::max<size_t>(shard_bytes, 1));
+        for (size_t i = 0; i < n; i++)
+        {
+            shard.begin = size * i / n;
+            shard.end = i + 1 == n ? SIZE_MAX : size * (i + 1) / n;
+            shards.push_back(shard);
+        }
+    }
+    return shards;
+}
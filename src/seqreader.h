@@ -0,0 +1,155 @@
+/*
+ * seqreader.h
+ *
+ *  Chunked FASTA/FASTQ/plain sequence parser. The input is scanned a large
+ *  buffer at a time (the mmap'ed file itself when it is not compressed),
+ *  records are string_views into that buffer and sequences are normalized
+ *  in place, so nothing is allocated per line or per record.
+ */
+
+#ifndef SOURCE_DIRECTORY__SRC_SPARC_SEQREADER_H_
+#define SOURCE_DIRECTORY__SRC_SPARC_SEQREADER_H_
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include "io.h"
+
+enum class SeqFormat
+{
+    FASTA,
+    FASTQ,
+    LINE // one sequence per line
+};
+
+/*
+ * A record in a parser buffer, valid as long as the batch (or the owner)
+ * it came from is alive. The id keeps its '>' or '@', the sequence is
+ * upper case ACGTN with the line breaks of multi-line FASTA removed.
+ */
+struct SeqView
+{
+    std::string_view id;
+    std::string_view seq;
+};
+
+struct MappedInput;
+
+/*
+ * A file, or the records of a file that start in [begin, end). Ranges
+ * are only used for uncompressed regular files.
+ */
+struct InputShard
+{
+    std::string path;
+    size_t begin = 0;
+    size_t end = SIZE_MAX;
+};
+
+/*
+ * Splits the files into about parts shards (of at least min_bytes), for
+ * workers that read on their own. Compressed files and stdin can not be
+ * split and are one shard each.
+ */
+std::vector<InputShard> make_shards(const std::vector<std::string> &files, size_t parts, size_t min_bytes = 1 << 20);
+
+/*
+ * Reads one file a chunk at a time. Uncompressed files are mmap'ed
+ * privately and parsed in place; gzip files and stdin ("-") are read in
+ * chunk_size pieces, with the unfinished record at the end of a chunk
+ * carried over to the next one. A chunk grows until it holds at least one
+ * record, so records may be larger than chunk_size.
+ *
+ * Throws std::runtime_error on I/O or format errors.
+ */
+class ChunkedSeqReader
+{
+protected:
+    std::string filepath;
+    SeqFormat format;
+    size_t chunk_size;
+
+    std::shared_ptr<MappedInput> mapped;
+    size_t cursor = 0;
+    size_t limit = 0; // end of the shard in the mapping
+
+    std::unique_ptr<std::istream> owned_stream;
+    std::istream *stream = nullptr;
+    AsyncIStream *async = nullptr; // owned_stream, for the gzip errors
+    std::vector<char> tail;
+    bool stream_eof = false;
+
+public:
+    ChunkedSeqReader(const std::string &filepath, SeqFormat format, size_t chunk_size = 8 << 20);
+
+    // only the records of the shard, a shard and the next one never overlap
+    ChunkedSeqReader(const InputShard &shard, SeqFormat format, size_t chunk_size = 8 << 20);
+    ChunkedSeqReader(const ChunkedSeqReader &) = delete;
+    ChunkedSeqReader &operator=(const ChunkedSeqReader &) = delete;
+    virtual ~ChunkedSeqReader();
+
+    /*
+     * The records of the next chunk, and the buffer they point into.
+     * Returns false at the end of the file.
+     */
+    bool next(std::vector<SeqView> &records, std::shared_ptr<const void> &owner);
+
+    /*
+     * Parses the complete records of [begin, end) in place and appends
+     * them to records. An unfinished record at the end is left alone
+     * unless at_eof. Returns the number of bytes consumed.
+     */
+    static size_t parse(char *begin, char *end, bool at_eof, SeqFormat format, std::vector<SeqView> &records);
+
+    /*
+     * The offset of the first record that starts at or after pos (size if
+     * there is none). A FASTQ record is an '@' line followed by a line and a
+     * '+' line, which a quality line starting with '@' never is.
+     */
+    static size_t record_start(const char *data, size_t size, size_t pos, SeqFormat format);
+
+protected:
+    void open(size_t begin, size_t end);
+    bool next_mapped(std::vector<SeqView> &records, std::shared_ptr<const void> &owner);
+    bool next_streamed(std::vector<SeqView> &records, std::shared_ptr<const void> &owner);
+    size_t read_some(char *buf, size_t n);
+};
+
+// a batch of records, together with the buffers they point into
+struct SeqBatch : public std::vector<SeqView>
+{
+    std::vector<std::shared_ptr<const void>> owners;
+};
+
+/*
+ * BatchReader over ChunkedSeqReader: the files one after another, batches
+ * of up to batch_size records. Batches can be moved around freely, e.g.
+ * through PipelinedReader, they keep their buffers alive.
+ */
+class ChunkedBatchReader
+{
+protected:
+    std::vector<std::string> files;
+    SeqFormat format;
+    size_t chunk_size;
+    size_t curr_file_index = 0;
+    std::unique_ptr<ChunkedSeqReader> reader;
+
+    std::vector<SeqView> chunk;
+    std::shared_ptr<const void> chunk_owner;
+    size_t chunk_pos = 0;
+
+public:
+    ChunkedBatchReader(const std::vector<std::string> &files, SeqFormat format, size_t chunk_size = 8 << 20);
+
+    SeqBatch next(size_t batch_size);
+
+protected:
+    bool next_chunk();
+};
+
+typedef PipelinedReader<ChunkedBatchReader> PipelinedSeqReader;
+
+#endif /* SOURCE_DIRECTORY__SRC_SPARC_SEQREADER_H_ */
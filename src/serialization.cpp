@@ -1,7 +1,8 @@
 #include "model.h"
 #include "serialization.h"
 
-void save_model(uint32_t this_epoch, const std::string &output_prefix, SingleNodeModel<float> &model, bool zip_output)
+template <typename S>
+void save_model(uint32_t this_epoch, const std::string &output_prefix, SingleNodeModel<float, S> &model, bool zip_output)
 {
     char txt[1024];
     sprintf(txt, "%s_%u.bin", output_prefix.c_str(), this_epoch);
@@ -29,7 +30,8 @@ void save_model(uint32_t this_epoch, const std::string &output_prefix, SingleNod
     }
 }
 
-void save_vector(uint32_t this_epoch, const std::string &output_prefix, SingleNodeModel<float> &model, bool zip_output)
+template <typename S>
+void save_vector(uint32_t this_epoch, const std::string &output_prefix, SingleNodeModel<float, S> &model, bool zip_output)
 {
     char txt[1024];
     sprintf(txt, "%s_%u.vec", output_prefix.c_str(), this_epoch);
@@ -53,7 +55,8 @@ void save_vector(uint32_t this_epoch, const std::string &output_prefix, SingleNo
     }
 }
 
-void save_wordcounts(uint32_t this_epoch, const std::string &output_prefix, SingleNodeModel<float> &model, bool zip_output)
+template <typename S>
+void save_wordcounts(uint32_t this_epoch, const std::string &output_prefix, SingleNodeModel<float, S> &model, bool zip_output)
 {
     char txt[1024];
     sprintf(txt, "%s_%u.wc.txt", output_prefix.c_str(), this_epoch);
@@ -78,7 +81,9 @@ void save_wordcounts(uint32_t this_epoch, const std::string &output_prefix, Sing
 }
 
 
-void save_vector_bin(uint32_t this_epoch, const std::string &output_prefix, SingleNodeModel<float> &model, bool zip_output)
+template <typename S>
+void save_vector_bin(uint32_t this_epoch, const std::string &output_prefix, SingleNodeModel<float, S> &model, bool zip_output,
+                     ValueType precision)
 {
     char txt[1024];
     sprintf(txt, "%s_%u.vec.bin", output_prefix.c_str(), this_epoch);
@@ -92,35 +97,35 @@ void save_vector_bin(uint32_t this_epoch, const std::string &output_prefix, Sing
     {
         ogzstream output(filepath.c_str());
         bitsery::OutputStreamAdapter bw(output);
-        model.write_vec_bin(bw);
+        model.write_vec_bin(bw, precision);
         output.flush();
     }
     else
     {
         std::ofstream output(txt, std::ios::binary | std::ios::trunc);
         bitsery::OutputStreamAdapter bw(output);
-        model.write_vec_bin(bw);
+        model.write_vec_bin(bw, precision);
         output.flush();
     }
 }
 
-void read_vec_bin(const std::string &binpath, std::vector<Vector<float>> &wi)
+void read_vec_bin(const std::string &binpath, Matrix<float> &wi)
 {
     if (sparc::endswith(binpath, ".gz"))
     {
         igzstream input(binpath.c_str());
         bitsery::InputStreamAdapter br(input);
-        read(br, wi);
+        wi.read_vec_bin(br);
     }
     else
     {
         std::ifstream input(binpath, std::ios::binary);
         bitsery::InputStreamAdapter br(input);
-        read(br, wi);
+        wi.read_vec_bin(br);
     }
 }
 
-void read_model(const std::string &modelpath, SingleNodeModel<float> &model)
+void read_model(const std::string &modelpath, SingleNodeModel<float, float> &model)
 {
     uint32_t this_epoch;
     if (sparc::endswith(modelpath, ".gz"))
@@ -137,4 +142,13 @@ void read_model(const std::string &modelpath, SingleNodeModel<float> &model)
         read(br, this_epoch);
         model.read_me(br);
     }
-}
\ No newline at end of file
+}
+#define INSTANTIATE_SAVE(S)                                                                                          \
+    template void save_model(uint32_t, const std::string &, SingleNodeModel<float, S> &, bool);                     \
+    template void save_vector(uint32_t, const std::string &, SingleNodeModel<float, S> &, bool);                    \
+    template void save_wordcounts(uint32_t, const std::string &, SingleNodeModel<float, S> &, bool);                \
+    template void save_vector_bin(uint32_t, const std::string &, SingleNodeModel<float, S> &, bool, ValueType);
+
+INSTANTIATE_SAVE(float)
+INSTANTIATE_SAVE(bf16_t)
+INSTANTIATE_SAVE(fp16_t)
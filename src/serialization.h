@@ -2,23 +2,36 @@
 #define _SRC_serialization_H_
 
 #include <string>
+#include "half.h"
 
 template <typename T>
 class Vector;
 
 template <typename T>
+class Matrix;
+
+template <typename T, typename S>
 class SingleNodeModel;
 
-void save_model(uint32_t this_epoch, const std::string &output_prefix, SingleNodeModel<float> &model, bool zip_output);
+// the model functions are instantiated for float, bf16_t and fp16_t storage
+
+template <typename S>
+void save_model(uint32_t this_epoch, const std::string &output_prefix, SingleNodeModel<float, S> &model, bool zip_output);
 
-void save_vector(uint32_t this_epoch, const std::string &output_prefix, SingleNodeModel<float> &model, bool zip_output);
+template <typename S>
+void save_vector(uint32_t this_epoch, const std::string &output_prefix, SingleNodeModel<float, S> &model, bool zip_output);
 
-void save_vector_bin(uint32_t this_epoch, const std::string &output_prefix, SingleNodeModel<float> &model, bool zip_output);
+// the input vectors, by default in fp32
+template <typename S>
+void save_vector_bin(uint32_t this_epoch, const std::string &output_prefix, SingleNodeModel<float, S> &model, bool zip_output,
+                     ValueType precision = ValueType::FP32);
 
-void save_wordcounts(uint32_t this_epoch, const std::string &output_prefix, SingleNodeModel<float> &model, bool zip_output);
+template <typename S>
+void save_wordcounts(uint32_t this_epoch, const std::string &output_prefix, SingleNodeModel<float, S> &model, bool zip_output);
 
-void read_vec_bin(const std::string &binpath, std::vector<Vector<float>> &wi);
+// a .vec.bin of any precision, converted to float
+void read_vec_bin(const std::string &binpath, Matrix<float> &wi);
 
-void read_model(const std::string &modelpath, SingleNodeModel<float> &model);
+void read_model(const std::string &modelpath, SingleNodeModel<float, float> &model);
 
 #endif //_SRC_serialization_H_
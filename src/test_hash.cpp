@@ -7,7 +7,9 @@
 
 
 #include "utils.h"
+#include "kmer.h"
 #include "CRandProj.h"
+#include "model.h"
 #include "acutest.h"
 
 #define TOLERANCE 0.00001f
@@ -337,8 +339,168 @@ void rp_test_save_load ()
     }
 }
 
+std::string random_seq(size_t n)
+{
+    std::string seq(n, 'A');
+    for (size_t i = 0; i < n; i++)
+    {
+        seq[i] = "ACGT"[(int)(sparc::myrand::uniform<double>() * 4) % 4];
+    }
+    return seq;
+}
+
+std::shared_ptr<CRandProj> random_rp(int kmer_size, int hash_size)
+{
+    std::vector<std::string> kmers;
+    for (int i = 0; i < kmer_size * hash_size * 2; i++)
+    {
+        kmers.push_back(random_seq(kmer_size));
+    }
+    RandProjBuilder builder(kmer_size, hash_size, 0);
+    builder.create_hash(kmers);
+    return builder.make_rp();
+}
+
+void rp_test_packed()
+{
+    for (int kmer_size : {5, 15, 32})
+    {
+        auto rp = random_rp(kmer_size, 12);
+        rp->save("rp2.bin");
+        CRandProj rp2;
+        TEST_CHECK(rp2.load("rp2.bin") == 0);
+
+        std::string seq = random_seq(2000);
+        std::string kmer;
+        for (KmerIterator it(seq, kmer_size); it.next();)
+        {
+            kmer = seq.substr(it.position(), kmer_size);
+            unsigned long h = rp->hash(kmer, false);
+            TEST_INT_EQUAL(h, rp->hash_packed(it.forward()));
+            TEST_INT_EQUAL(h, rp2.hash_packed(it.forward()));
+            TEST_INT_EQUAL(rp->hash(canonical_kmer(kmer), false), rp->hash_packed(it.canonical()));
+        }
+    }
+}
+
+void rp_test_batch()
+{
+    for (int kmer_size : {5, 15, 31})
+    {
+        for (int hash_size : {3, 12, 24, 32})
+        {
+            auto rp = random_rp(kmer_size, hash_size);
+            CRandProjTable table(*rp);
+            std::string seq = random_seq(1000 + kmer_size + 13);
+            std::vector<uint64_t> packed;
+            std::vector<unsigned long> expected;
+            for (KmerIterator it(seq, kmer_size); it.next();)
+            {
+                packed.push_back(it.canonical());
+                expected.push_back(rp->hash(canonical_kmer(seq.substr(it.position(), kmer_size)), false));
+            }
+            for (int isa = CRandProjTable::ISA_SCALAR; isa <= CRandProjTable::detect_isa(); isa++)
+            {
+                table.set_isa((CRandProjTable::Isa)isa);
+                std::vector<uint32_t> out(packed.size());
+                table.hash_batch(packed.data(), packed.size(), out.data());
+                for (size_t i = 0; i < out.size(); i++)
+                {
+                    TEST_INT_EQUAL(expected.at(i), out.at(i));
+                }
+            }
+        }
+    }
+}
+
+// a read and its reverse complement get the same buckets in reverse order
+void rp_test_strand()
+{
+    for (int kmer_size : {5, 15, 32, 40})
+    {
+        auto rp = random_rp(kmer_size, 12);
+        std::string seq = random_seq(500) + "N" + random_seq(200);
+        std::vector<uint32_t> fwd, rev;
+        rp->hash_seq(seq, fwd);
+        rp->hash_seq(reverse_complement(seq), rev);
+        std::reverse(rev.begin(), rev.end());
+        TEST_CHECK(fwd == rev);
+    }
+}
+
+void rp_test_block()
+{
+    for (int kmer_size : {5, 15, 31, 32})
+    {
+        auto rp = random_rp(kmer_size, 24);
+        CRandProjTable exact(*rp);
+        std::string seq = random_seq(1000);
+        std::vector<uint64_t> packed;
+        for (KmerIterator it(seq, kmer_size); it.next();)
+        {
+            packed.push_back(it.forward());
+        }
+        for (int lookup_bases = 2; lookup_bases <= CRandProjTable::MAX_LOOKUP_BASES; lookup_bases++)
+        {
+            CRandProjTable table(*rp, lookup_bases);
+            std::vector<uint32_t> out(packed.size());
+            table.hash_batch(packed.data(), packed.size(), out.data());
+            double p1[CRandProjTable::MAX_HASH_SIZE], p2[CRandProjTable::MAX_HASH_SIZE];
+            for (size_t i = 0; i < packed.size(); i++)
+            {
+                exact.project(packed[i], p1);
+                table.project(packed[i], p2);
+                for (int j = 0; j < 24; j++)
+                {
+                    TEST_CHECK(std::abs(p1[j] - p2[j]) < 1e-9);
+                }
+                TEST_INT_EQUAL(table.hash(packed[i]), out[i]);
+            }
+        }
+    }
+}
+
+// kmers longer than a packed word are hashed as strings, with the buckets of the old string path
+void rp_test_long_kmer()
+{
+    for (int kmer_size : {33, 40})
+    {
+        auto rp = random_rp(kmer_size, 12);
+        rp->save("rp2.bin");
+        CRandProj rp2;
+        TEST_CHECK(rp2.load("rp2.bin") == 0);
+        TEST_CHECK(rp2.compile(2) == 0);
+
+        std::string seq = random_seq(300) + "NN" + random_seq(20) + "N" + random_seq(300);
+        std::vector<uint32_t> buckets;
+        rp2.hash_seq(seq, buckets);
+        std::vector<std::string> kmers = generate_kmer_for_fastseq(seq, kmer_size, "N", true);
+        TEST_CHECK(buckets.size() == kmers.size());
+        for (size_t i = 0; i < kmers.size() && i < buckets.size(); i++)
+        {
+            TEST_INT_EQUAL(rp->hash(kmers[i], false), buckets[i]);
+        }
+
+        // the buckets train and transform like any others
+        SingleNodeModel<float> model(1 << 12, 16, 5, false, 3);
+        model.randomize_init();
+        for (int epoch = 0; epoch < 3; epoch++)
+        {
+            TEST_CHECK(std::isfinite(model.update(buckets, 0.05f, epoch == 0)));
+        }
+        for (uint32_t b : buckets)
+        {
+            TEST_CHECK(b < (1u << 12));
+        }
+    }
+}
 
 TEST_LIST = {
     {"rp_test", rp_test},
     {"rp_test_save_load", rp_test_save_load},
+    {"rp_test_packed", rp_test_packed},
+    {"rp_test_batch", rp_test_batch},
+    {"rp_test_strand", rp_test_strand},
+    {"rp_test_block", rp_test_block},
+    {"rp_test_long_kmer", rp_test_long_kmer},
 			 {NULL, NULL}};
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <iostream>
 #include "catch.hpp"
 #include "kmer.h"
+#include "seqpack.h"
 using namespace std;
 
 TEST_CASE( "kmer and number ", "[kmer]" ) {
@@ -120,6 +121,54 @@ TEST_CASE( "test kmer gen for fastseq", "[kmer]" ) {
 
 }
 
+TEST_CASE( "rolling kmer iterator", "[kmer]" ) {
+	string seq = "ATCGACGTNACNACTGGTACNNNGCAAAGAAAACGCTGGAAAACAGCGTGCTGGTT";
+	string kmer;
+	for (int k : { 1, 3, 5, 11, 31 }) {
+		vector<string> expected = generate_kmer_for_fastseq(seq, k, "N",
+				true);
+		vector<string> kmers;
+		for (KmerIterator it(seq, k); it.next();) {
+			packed_to_kmer(it.forward(), k, kmer);
+			REQUIRE(kmer == seq.substr(it.position(), k));
+			packed_to_kmer(it.reverse(), k, kmer);
+			REQUIRE(kmer == reverse_complement(seq.substr(it.position(), k)));
+			packed_to_kmer(it.canonical(), k, kmer);
+			kmers.push_back(kmer);
+		}
+		REQUIRE(kmers == expected);
+	}
+
+	seq = "ACGTACGTACGTACGTACGTACGTACGTACGTA";
+	int n = 0;
+	for (KmerIterator it(seq, 32); it.next(); n++) {
+		packed_to_kmer(it.forward(), 32, kmer);
+		REQUIRE(kmer == seq.substr(it.position(), 32));
+	}
+	REQUIRE(n == 2);
+
+	REQUIRE_THROWS(KmerIterator(seq, 33));
+}
+
+TEST_CASE( "normalize sequence", "[kmer]" ) {
+	const char alphabet[] = "ACGTacgtNnRYKMSWBDHV-.*\xff";
+	for (size_t len = 0; len < 100; len++) {
+		string seq;
+		for (size_t i = 0; i < len; i++) {
+			seq += alphabet[rand() % (sizeof(alphabet) - 1)];
+		}
+		string expected = seq;
+		for (char &c : expected) {
+			c = (char) ::toupper(c);
+			if (c != 'A' && c != 'C' && c != 'G' && c != 'T') {
+				c = 'N';
+			}
+		}
+		normalize_seq(&seq[0], seq.size());
+		REQUIRE(seq == expected);
+	}
+}
+
 TEST_CASE( "test with bigger seq ", "[kmer]" ) {
 
 	//"Kmer generator" should "work as expected"
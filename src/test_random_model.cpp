@@ -2,6 +2,7 @@
 #define CATCH_CONFIG_MAIN
 
 #include <iostream>
+#include <sstream>
 #include "catch.hpp"
 #include "model.h"
 using namespace std;
@@ -10,7 +11,7 @@ template <typename VALUE_TYPE>
 class RandomModel : public Model<VALUE_TYPE>
 {
 public:
-	RandomModel(uint32_t dim, uint32_t neg_size, bool use_cbow) : Model<VALUE_TYPE>(dim, neg_size, use_cbow, 5)
+	RandomModel(uint32_t dim, uint32_t neg_size, bool use_cbow) : Model<VALUE_TYPE>(dim, neg_size, use_cbow, 5), row(dim)
 	{
 	}
 
@@ -28,14 +29,17 @@ protected:
 	{
 		return 1;
 	}
-	virtual Vector<VALUE_TYPE> get_vec_from_wi(uint32_t)
+	virtual VectorView<VALUE_TYPE> get_vec_from_wi(uint32_t)
 	{
-		return Vector<VALUE_TYPE>(this->dim);
+		return row.view();
 	}
-	virtual Vector<VALUE_TYPE> get_vec_from_wo(uint32_t)
+	virtual VectorView<VALUE_TYPE> get_vec_from_wo(uint32_t)
 	{
-		return Vector<VALUE_TYPE>(this->dim);
+		return row.view();
 	}
+
+private:
+	Vector<VALUE_TYPE> row;
 };
 
 TEST_CASE("random_model ", "[model]")
@@ -73,3 +77,571 @@ TEST_CASE("single_node_model_cbow ", "[model]")
 	float loss = model.update({1, 2, 3, 4, 5}, 0.1f, true);
 	std::cout << "loss=" << loss << "\n";
 }
+
+TEST_CASE("matrix ", "[model]")
+{
+	Matrix<float> m(7, 10);
+	REQUIRE(m.get_stride() == 16);
+	for (uint32_t i = 0; i < m.get_rows(); i++)
+	{
+		REQUIRE((uintptr_t)m.row(i).data() % Matrix<float>::ALIGNMENT == 0);
+		m.row(i).randomize();
+	}
+
+	// same bytes as a vector of Vector
+	std::vector<Vector<float>> rows;
+	for (uint32_t i = 0; i < m.get_rows(); i++)
+	{
+		rows.push_back(Vector<float>(m.row(i)));
+	}
+	std::stringstream s1, s2;
+	bitsery::OutputStreamAdapter bw1(s1), bw2(s2);
+	write(bw1, m);
+	write(bw2, rows);
+	REQUIRE(s1.str() == s2.str());
+
+	Matrix<float> m2;
+	bitsery::InputStreamAdapter br(s2);
+	read(br, m2);
+	REQUIRE(m2.get_rows() == m.get_rows());
+	REQUIRE(m2.get_dim() == m.get_dim());
+	for (uint32_t i = 0; i < m.get_rows(); i++)
+	{
+		for (uint32_t j = 0; j < m.get_dim(); j++)
+		{
+			REQUIRE(m2.row(i)[j] == m.row(i)[j]);
+		}
+	}
+}
+
+TEST_CASE("single_node_model_kernel ", "[model]")
+{
+	// the dim-specialized kernel must train exactly like the runtime-dim one
+	for (bool use_cbow : {true, false})
+	{
+		SingleNodeModel<float> m1(200, 100, 5, use_cbow, 5), m2(200, 100, 5, use_cbow, 5);
+		sparc::myrand::seed(7);
+		m1.randomize_init();
+		sparc::myrand::seed(7);
+		m2.randomize_init();
+
+		std::vector<uint32_t> words = {1, 2, 3, 4, 5, 6, 7};
+		sparc::myrand::seed(11);
+		float loss1 = m1.update(words, 0.1f, true);
+		sparc::myrand::seed(11);
+		float loss2 = 0;
+		uint32_t count = 0;
+		for (size_t i = 0; i < words.size() && !use_cbow; i++)
+		{
+			std::vector<uint32_t> input_words;
+			for (int j = (int)i - 5; j < (int)i + 5; j++)
+			{
+				if (j >= 0 && j != (int)i && j < (int)words.size())
+				{
+					input_words.push_back(words.at(j));
+					loss2 += OneSampleKernel<float, SingleNodeModel<float>>::update_one(m2, words.at(i), input_words, 0.1f, true);
+					input_words.clear();
+					count++;
+				}
+			}
+		}
+		if (use_cbow)
+		{
+			// cbow slides over the whole read, see sliding_cbow
+			loss2 = OneSampleKernel<float, SingleNodeModel<float>>::update_cbow(m2, words, 0, words.size(), 5, 0.1f, true);
+			count = 1;
+		}
+		REQUIRE(loss1 == Approx(loss2 / count));
+
+		std::stringstream s1, s2;
+		bitsery::OutputStreamAdapter bw1(s1), bw2(s2);
+		write(bw1, m1);
+		write(bw2, m2);
+		REQUIRE(s1.str() == s2.str());
+	}
+}
+
+TEST_CASE("vecops ", "[model]")
+{
+	// every isa the cpu supports against the plain loops
+	vecops::Isa best = vecops::isa;
+	for (uint32_t n : {1, 7, 8, 15, 16, 17, 33, 100, 300})
+	{
+		std::vector<float> x(n), y(n), g(n);
+		for (uint32_t i = 0; i < n; i++)
+		{
+			x[i] = sparc::myrand::uniform<float>() * 2 - 1;
+			y[i] = sparc::myrand::uniform<float>() * 2 - 1;
+			g[i] = sparc::myrand::uniform<float>() * 2 - 1;
+		}
+		float d = vecops::dot<float>(x.data(), y.data(), n);
+		std::vector<float> y1 = y, v1 = x, g1 = g;
+		vecops::axpy<float>(0.3f, x.data(), y1.data(), n);
+		vecops::axpy2<float>(0.3f, v1.data(), y.data(), g1.data(), n);
+		for (int isa = vecops::ISA_SCALAR; isa <= best; isa++)
+		{
+			vecops::isa = (vecops::Isa)isa;
+			REQUIRE(vecops::dot(x.data(), y.data(), n) == Approx(d).margin(1e-5));
+			std::vector<float> y2 = y, v2 = x, g2 = g, s2 = x;
+			vecops::axpy(0.3f, x.data(), y2.data(), n);
+			vecops::axpy2(0.3f, v2.data(), y.data(), g2.data(), n);
+			vecops::scale(0.5f, s2.data(), n);
+			for (uint32_t i = 0; i < n; i++)
+			{
+				REQUIRE(y2[i] == Approx(y1[i]).margin(1e-6));
+				REQUIRE(v2[i] == Approx(v1[i]).margin(1e-6));
+				REQUIRE(g2[i] == Approx(g1[i]).margin(1e-6));
+				REQUIRE(s2[i] == x[i] * 0.5f);
+			}
+		}
+		vecops::isa = best;
+	}
+}
+
+TEST_CASE("negative_sampler ", "[model]")
+{
+	sparc::myrand::seed(7);
+	std::vector<uint32_t> counts = {0, 100, 0, 1, 16, 0, 0, 81};
+	NegativeSampler sampler(counts.size());
+	REQUIRE(sampler.get_kind() == NegativeSampler::UNIFORM);
+	REQUIRE(sampler.build_unigram(counts));
+	REQUIRE(sampler.get_kind() == NegativeSampler::UNIGRAM);
+	REQUIRE(sampler.support() == 4);
+
+	double total = 0;
+	for (uint32_t c : counts)
+	{
+		total += std::pow((double)c, 0.75);
+	}
+	const uint32_t n = 1000000;
+	std::vector<uint32_t> hits(counts.size(), 0);
+	for (uint32_t i = 0; i < n; i++)
+	{
+		hits.at(sampler.sample())++;
+	}
+	for (size_t i = 0; i < counts.size(); i++)
+	{
+		double expected = std::pow((double)counts[i], 0.75) / total;
+		REQUIRE((double)hits[i] / n == Approx(expected).margin(0.005));
+	}
+
+	// one seen bucket can not give a negative different from it
+	NegativeSampler one(4);
+	REQUIRE(!one.build_unigram({0, 5, 0, 0}));
+	REQUIRE(one.get_kind() == NegativeSampler::UNIFORM);
+}
+
+TEST_CASE("subsampler ", "[model]")
+{
+	sparc::myrand::seed(11);
+	// bucket 0 is 90% of the tokens
+	std::vector<uint32_t> counts = {900, 50, 50, 0};
+	Subsampler off(0);
+	REQUIRE(!off.build(counts));
+
+	Subsampler sub(0.05);
+	REQUIRE(sub.build(counts));
+	std::vector<uint32_t> words;
+	for (uint32_t i = 0; i < 100000; i++)
+	{
+		words.push_back(i % 10 == 0 ? 1 + i / 10 % 2 : 0);
+	}
+	std::vector<uint32_t> kept = words;
+	size_t n = sub.filter(kept);
+	REQUIRE(n == kept.size());
+
+	size_t n0 = std::count(kept.begin(), kept.end(), 0u);
+	double r = 0.05 / 0.9;
+	REQUIRE((double)n0 / 90000 == Approx(std::sqrt(r) + r).margin(0.01));
+	// rare buckets are always kept, in order
+	REQUIRE(kept.size() - n0 == 10000);
+	std::vector<uint32_t> rare, kept_rare;
+	std::copy_if(words.begin(), words.end(), std::back_inserter(rare), [](uint32_t w) { return w != 0; });
+	std::copy_if(kept.begin(), kept.end(), std::back_inserter(kept_rare), [](uint32_t w) { return w != 0; });
+	REQUIRE(rare == kept_rare);
+}
+
+TEST_CASE("half ", "[model]")
+{
+	// exact values survive, the rest rounds to nearest even
+	for (float x : {0.0f, 1.0f, -2.5f, 0.375f})
+	{
+		REQUIRE((float)bf16_t(x) == x);
+		REQUIRE((float)fp16_t(x) == x);
+	}
+	REQUIRE((float)bf16_t(1.0f + 0x1.0p-9f) == 1.0f);
+	REQUIRE((float)bf16_t(1.0f + 0x1.8p-8f) == 1.0f + 0x1.0p-7f);
+	REQUIRE((float)fp16_t(65504.0f) == 65504.0f);
+	REQUIRE(std::isinf((float)fp16_t(70000.0f)));
+	REQUIRE((float)fp16_t(0x1.0p-24f) == 0x1.0p-24f);
+	REQUIRE((float)fp16_t(0x1.0p-26f) == 0.0f);
+	REQUIRE(std::isnan((float)bf16_t(NAN)));
+	REQUIRE(std::isnan((float)fp16_t(NAN)));
+
+	// stochastic rounding is right on average, including fp16 subnormals,
+	// with every isa the cpu supports
+	sparc::myrand::seed(3);
+	vecops::Isa best = vecops::isa;
+	const uint32_t n = 37;
+	const int trials = 2000;
+	for (int isa = vecops::ISA_SCALAR; isa <= best; isa++)
+	{
+		vecops::isa = (vecops::Isa)isa;
+		std::vector<float> ones(n, 1.0f);
+		double sum_bf16 = 0, sum_fp16 = 0, sum_sub = 0;
+		for (int t = 0; t < trials; t++)
+		{
+			std::vector<bf16_t> b(n, bf16_t(1.0f));
+			std::vector<fp16_t> h(n, fp16_t(1.0f)), z(n, fp16_t(0.0f));
+			vecops::axpy(0x1.0p-9f, ones.data(), b.data(), n);
+			vecops::axpy(0x1.0p-12f, ones.data(), h.data(), n);
+			vecops::axpy(0x1.0p-26f, ones.data(), z.data(), n);
+			for (uint32_t i = 0; i < n; i++)
+			{
+				sum_bf16 += b[i];
+				sum_fp16 += h[i];
+				sum_sub += z[i];
+			}
+		}
+		REQUIRE(sum_bf16 / (n * trials) == Approx(1.0 + 0x1.0p-9).epsilon(1e-4));
+		REQUIRE(sum_fp16 / (n * trials) == Approx(1.0 + 0x1.0p-12).epsilon(1e-5));
+		REQUIRE(sum_sub / (n * trials) == Approx(0x1.0p-26).epsilon(0.1));
+
+		// reads are exact conversions
+		std::vector<bf16_t> x(n);
+		std::vector<float> xf(n), y(n), g(n, 0.0f), g2(n, 0.0f);
+		for (uint32_t i = 0; i < n; i++)
+		{
+			x[i] = sparc::myrand::uniform<float>() * 2 - 1;
+			xf[i] = x[i];
+			y[i] = sparc::myrand::uniform<float>() * 2 - 1;
+		}
+		REQUIRE(vecops::dot(x.data(), y.data(), n) == Approx(vecops::dot<float>(xf.data(), y.data(), n)).margin(1e-5));
+		vecops::add(x.data(), g.data(), n);
+		vecops::axpy2(0.5f, x.data(), y.data(), g2.data(), n);
+		for (uint32_t i = 0; i < n; i++)
+		{
+			REQUIRE(g[i] == xf[i]);
+			REQUIRE(g2[i] == xf[i] * 0.5f);
+			REQUIRE((float)x[i] == Approx(xf[i] + y[i] * 0.5f).margin(0x1.0p-7f));
+		}
+	}
+	vecops::isa = best;
+}
+
+TEST_CASE("half_model ", "[model]")
+{
+	SingleNodeModel<float, bf16_t> model(200, 16, 5, true, 5);
+	model.uniform_init();
+	float loss = model.update({1, 2, 3, 4, 5, 6, 7}, 0.1f, true);
+	REQUIRE(std::isfinite(loss));
+
+	// .vec.bin in every precision reads back as float
+	for (ValueType type : {ValueType::FP32, ValueType::BF16, ValueType::FP16})
+	{
+		std::stringstream s;
+		bitsery::OutputStreamAdapter bw(s);
+		model.write_vec_bin(bw, type);
+		Matrix<float> m;
+		bitsery::InputStreamAdapter br(s);
+		m.read_vec_bin(br);
+		REQUIRE(m.get_rows() == 200);
+		REQUIRE(m.get_dim() == 16);
+		for (uint32_t w : {0, 3, 199})
+		{
+			Vector<float> row(16);
+			model.transform({w}, row);
+			for (uint32_t j = 0; j < 16; j++)
+			{
+				REQUIRE(m.row(w)[j] == Approx(row.at(j)).epsilon(type == ValueType::FP16 ? 1e-3 : 0));
+			}
+		}
+	}
+}
+
+TEST_CASE("huffman_tree ", "[model]")
+{
+	std::vector<uint32_t> counts = {0, 100, 0, 1, 16, 0, 0, 81, 4};
+	HuffmanTree tree;
+	REQUIRE(tree.empty());
+	REQUIRE(!tree.build({0, 5, 0}));
+	REQUIRE(tree.empty());
+	REQUIRE(tree.build(counts));
+	REQUIRE(tree.num_leaves() == 5);
+	REQUIRE(tree.num_nodes() == 4);
+
+	double kraft = 0, tokens = 0, weighted = 0;
+	std::vector<std::vector<uint32_t>> paths;
+	for (uint32_t w = 0; w < counts.size() + 2; w++)
+	{
+		HuffmanTree::Path path = tree.path(w);
+		if (w >= counts.size() || counts[w] == 0)
+		{
+			REQUIRE(path.empty());
+			continue;
+		}
+		REQUIRE(!path.empty());
+		// every path starts at the root and only visits inner nodes
+		REQUIRE(HuffmanTree::node(*path.begin()) == 0);
+		for (uint32_t step : path)
+		{
+			REQUIRE(HuffmanTree::node(step) < tree.num_nodes());
+		}
+		kraft += std::pow(2.0, -(double)path.size());
+		tokens += counts[w];
+		weighted += counts[w] * (double)path.size();
+		paths.emplace_back(path.begin(), path.end());
+	}
+	// a full binary tree, and no code is a prefix of another
+	REQUIRE(kraft == Approx(1.0));
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		for (size_t j = 0; j < paths.size(); j++)
+		{
+			if (i != j && paths[i].size() <= paths[j].size())
+			{
+				REQUIRE(!std::equal(paths[i].begin(), paths[i].end(), paths[j].begin()));
+			}
+		}
+	}
+	REQUIRE(tree.mean_depth() == Approx(weighted / tokens));
+	// the most frequent bucket has the shortest path
+	REQUIRE(tree.path(1).size() == 1);
+	REQUIRE(tree.path(3).size() >= tree.path(4).size());
+}
+
+TEST_CASE("hierarchical_softmax ", "[model]")
+{
+	for (bool use_cbow : {true, false})
+	{
+		sparc::myrand::seed(5);
+		SingleNodeModel<float> model(200, 16, 5, use_cbow, 2);
+		model.randomize_init();
+		std::vector<uint32_t> words = {1, 2, 3, 4, 5, 6, 7, 1, 2, 3};
+		model.update(words, 0.1f, true);
+		REQUIRE(model.build_huffman_tree());
+		REQUIRE(model.get_tree().num_leaves() == 7);
+
+		float first = model.update(words, 0.1f, false);
+		float last = first;
+		for (int i = 0; i < 100; i++)
+		{
+			last = model.update(words, 0.1f, false);
+		}
+		REQUIRE(std::isfinite(first));
+		// skipgram predicts every label from single neighbours and levels off higher
+		REQUIRE(last < first * 0.8f);
+
+		// buckets that were not counted have nothing to predict
+		REQUIRE(model.update({1, 2, 100, 3}, 2, 3, 0.1f, false) == 0);
+	}
+}
+
+TEST_CASE("minibatch_kernel ", "[model]")
+{
+	// one sample per batch trains like the single sample kernel, as long
+	// as no negative is drawn twice or equals the label. 0.6 is above
+	// max_lr(1), the kernel still trains with the rate it is given
+	for (bool use_cbow : {true, false})
+	{
+		for (float lr : {0.1f, 0.6f})
+		{
+			SingleNodeModel<float> m1(100000, 16, 5, use_cbow, 2), m2(100000, 16, 5, use_cbow, 2);
+			sparc::myrand::seed(3);
+			m1.randomize_init();
+			sparc::myrand::seed(3);
+			m2.randomize_init();
+			m2.set_minibatch(1);
+
+			std::vector<uint32_t> words = {1, 2, 3, 4, 5, 6, 7, 3, 3};
+			sparc::myrand::seed(13);
+			float loss1 = m1.update(words, lr, true);
+			sparc::myrand::seed(13);
+			float loss2 = m2.update(words, lr, true);
+			REQUIRE(loss2 == Approx(loss1));
+			REQUIRE(m1.get_word_count() == m2.get_word_count());
+			for (uint32_t w : {1, 3, 7})
+			{
+				Vector<float> r1(16), r2(16);
+				m1.transform({w}, r1);
+				m2.transform({w}, r2);
+				for (uint32_t j = 0; j < 16; j++)
+				{
+					REQUIRE(r2.at(j) == Approx(r1.at(j)).margin(1e-6));
+				}
+			}
+		}
+	}
+}
+
+TEST_CASE("minibatch_model ", "[model]")
+{
+	for (bool use_cbow : {true, false})
+	{
+		sparc::myrand::seed(5);
+		SingleNodeModel<float, bf16_t> model(200, 16, 5, use_cbow, 2);
+		model.randomize_init();
+		model.set_minibatch(4);
+		std::vector<uint32_t> words = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
+		float first = model.update(words, 0.1f, true);
+		// a few shared negatives make single passes noisy
+		float last = 0;
+		for (int i = 0; i < 100; i++)
+		{
+			float loss = model.update(words, 0.1f, false);
+			last += i >= 80 ? loss / 20 : 0;
+		}
+		REQUIRE(std::isfinite(first));
+		REQUIRE(last < first * 0.5f);
+		// word counts are the same as one sample at a time, skipgram counts a
+		// label once per context word of the window [i-2, i+2)
+		uint32_t labels = 0;
+		for (uint32_t c : model.get_word_count())
+		{
+			labels += c;
+		}
+		REQUIRE(labels == (use_cbow ? words.size() : 3 * words.size() - 4));
+	}
+}
+
+TEST_CASE("minibatch_loss_parity ", "[model]")
+{
+	// a few epochs over the same reads end at about the loss of the single
+	// sample kernel, at a rate below max_lr(16)
+	std::vector<std::vector<uint32_t>> reads(100);
+	sparc::myrand::seed(1);
+	for (auto &read : reads)
+	{
+		for (uint32_t i = 0; i < 100; i++)
+		{
+			// a fixed cycle over 50 words with noise from 1000
+			uint32_t r = (uint32_t)(sparc::myrand::uniform<float>() * 1000);
+			read.push_back(r < 500 ? i % 50 : r);
+		}
+	}
+	for (bool use_cbow : {true, false})
+	{
+		float last[2] = {0, 0};
+		for (uint32_t batch : {0u, 16u})
+		{
+			sparc::myrand::seed(5);
+			SingleNodeModel<float> model(1000, 32, 5, use_cbow, 3);
+			model.randomize_init();
+			model.set_minibatch(batch);
+			for (int epoch = 0; epoch < 5; epoch++)
+			{
+				float loss = 0;
+				for (auto &read : reads)
+				{
+					loss += model.update(read, 0.05f, epoch == 0) / reads.size();
+				}
+				last[batch > 0] = loss;
+			}
+		}
+		REQUIRE(std::isfinite(last[1]));
+		// sharing 5 negatives over 16 samples costs a little, averaging the
+		// steps of the output rows instead of summing them costs far more
+		REQUIRE(last[1] == Approx(last[0]).epsilon(0.2));
+	}
+}
+
+TEST_CASE("shared_negatives ", "[model]")
+{
+	// with one context word per position, sharing changes nothing
+	{
+		SingleNodeModel<float> m1(100000, 16, 5, false, 1), m2(100000, 16, 5, false, 1);
+		sparc::myrand::seed(3);
+		m1.randomize_init();
+		sparc::myrand::seed(3);
+		m2.randomize_init();
+		m2.set_shared_negatives(true);
+
+		std::vector<uint32_t> words = {1, 2, 3, 4, 5, 6, 7, 3, 3};
+		sparc::myrand::seed(13);
+		float loss1 = m1.update(words, 0.1f, true);
+		sparc::myrand::seed(13);
+		float loss2 = m2.update(words, 0.1f, true);
+		REQUIRE(loss2 == Approx(loss1));
+		REQUIRE(m1.get_word_count() == m2.get_word_count());
+		for (uint32_t w : {1, 3, 7})
+		{
+			Vector<float> r1(16), r2(16);
+			m1.transform({w}, r1);
+			m2.transform({w}, r2);
+			for (uint32_t j = 0; j < 16; j++)
+			{
+				REQUIRE(r2.at(j) == Approx(r1.at(j)).margin(1e-6));
+			}
+		}
+	}
+
+	sparc::myrand::seed(5);
+	SingleNodeModel<float, bf16_t> model(200, 16, 5, false, 2);
+	model.randomize_init();
+	model.set_shared_negatives(true);
+	std::vector<uint32_t> words = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
+	float first = model.update(words, 0.1f, true);
+	float last = first;
+	for (int i = 0; i < 100; i++)
+	{
+		last = model.update(words, 0.1f, false);
+	}
+	REQUIRE(std::isfinite(first));
+	REQUIRE(last < first * 0.8f);
+	uint32_t labels = 0;
+	for (uint32_t c : model.get_word_count())
+	{
+		labels += c;
+	}
+	REQUIRE(labels == 3 * words.size() - 4);
+}
+
+TEST_CASE("sliding_cbow ", "[model]")
+{
+	// the running window sum trains like summing every window from
+	// scratch, also with words repeated inside a window and past a resum
+	typedef SingleNodeModel<float> M;
+	M m1(1000, 16, 5, true, 3), m2(1000, 16, 5, true, 3);
+	sparc::myrand::seed(3);
+	m1.randomize_init();
+	sparc::myrand::seed(3);
+	m2.randomize_init();
+
+	std::vector<uint32_t> words;
+	for (uint32_t i = 0; i < 300; i++)
+	{
+		words.push_back(i % 4 == 0 ? 3 : (i * 37) % 1000);
+	}
+	sparc::myrand::seed(13);
+	float loss1 = m1.update(words, 5, 290, 0.1f, true);
+
+	sparc::myrand::seed(13);
+	float loss2 = 0;
+	std::vector<uint32_t> input_words;
+	for (int i = 5; i < 290; i++)
+	{
+		input_words.clear();
+		for (int j = i - 3; j < i + 3; j++)
+		{
+			if (j != i)
+			{
+				input_words.push_back(words[j]);
+			}
+		}
+		loss2 += OneSampleKernel<float, M>::update_one(m2, words[i], input_words, 0.1f, true);
+	}
+	loss2 /= 285;
+
+	REQUIRE(loss1 == Approx(loss2));
+	REQUIRE(m1.get_word_count() == m2.get_word_count());
+	for (uint32_t w : {3u, 37u, 74u, 999u})
+	{
+		Vector<float> r1(16), r2(16);
+		m1.transform({w}, r1);
+		m2.transform({w}, r2);
+		for (uint32_t j = 0; j < 16; j++)
+		{
+			REQUIRE(r1.at(j) == Approx(r2.at(j)).margin(1e-5));
+		}
+	}
+}
@@ -4,6 +4,7 @@
 #include <algorithm>
 
 #include "io.h"
+#include "seqreader.h"
 
 #define CATCH_CONFIG_MAIN
 #include "catch.hpp"
@@ -149,4 +150,149 @@ TEST_CASE("read seq text using batch", "[seq text]")
 	REQUIRE(V[1].seq.size() == 300);
 	REQUIRE(V[2].seq.size() == 351);
 	REQUIRE(V[3].seq.size() == 300);
-}
\ No newline at end of file
+}
+TEST_CASE("read using pipelined batch", "[pipeline]")
+{
+	std::vector<std::string> files = {"knucleotide.fasta", "knucleotide.fasta.gz", "sample.fa", "sample.fa.gz"};
+	BatchReader<FastaTextReaderBase, FastaRecord> reader(files);
+	PipelinedBatchReader<FastaTextReaderBase, FastaRecord> preader(files, 2);
+	size_t n = 0;
+	while (true)
+	{
+		std::vector<FastaRecord> v = reader.next(1);
+		std::vector<FastaRecord> pv = preader.next(1);
+		REQUIRE(v.size() == pv.size());
+		if (v.empty())
+		{
+			break;
+		}
+		REQUIRE(v[0].id == pv[0].id);
+		REQUIRE(v[0].seq == pv[0].seq);
+		n++;
+	}
+	REQUIRE(n == 10);
+
+	// a reader that is dropped before the end stops its threads
+	{
+		PipelinedBatchReader<FastaTextReaderBase, FastaRecord> early(files, 1);
+		REQUIRE(early.next(1).size() == 1);
+	}
+
+	// small chunks split lines
+	AsyncIStream input(std::unique_ptr<std::istream>(new igzstream("sample.fa.gz")), 7, 2);
+	std::ifstream plain("sample.fa");
+	std::string line, expected;
+	size_t lines = 0;
+	while (std::getline(plain, expected))
+	{
+		REQUIRE(std::getline(input, line));
+		REQUIRE(line == expected);
+		lines++;
+	}
+	REQUIRE(!std::getline(input, line));
+	REQUIRE(lines > 2);
+}
+
+template <class BASE_READER>
+void compare_chunked(const std::vector<std::string> &files, SeqFormat format, size_t chunk_size)
+{
+	BatchReader<BASE_READER, FastaRecord> reader(files);
+	ChunkedBatchReader creader(files, format, chunk_size);
+	while (true)
+	{
+		std::vector<FastaRecord> v = reader.next(3);
+		SeqBatch cv = creader.next(3);
+		REQUIRE(v.size() == cv.size());
+		if (v.empty())
+		{
+			break;
+		}
+		for (size_t i = 0; i < v.size(); i++)
+		{
+			REQUIRE(v[i].id == cv[i].id);
+			REQUIRE(v[i].seq == cv[i].seq);
+		}
+	}
+}
+
+TEST_CASE("read using chunked parser", "[chunked]")
+{
+	// chunks of a few bytes make every record span chunks
+	for (size_t chunk_size : {1, 100, 8 << 20})
+	{
+		compare_chunked<FastaTextReaderBase>({"knucleotide.fasta", "knucleotide.fasta.gz", "sample.fa", "sample.fa.gz"},
+											 SeqFormat::FASTA, chunk_size);
+		compare_chunked<FastqTextReaderBase>({"sample.fq", "sample.fq.gz"}, SeqFormat::FASTQ, chunk_size);
+		compare_chunked<SeqTextReaderBase>({"sample.txt", "sample.txt.gz"}, SeqFormat::LINE, chunk_size);
+	}
+
+	// batches keep their buffers after the reader is gone
+	SeqBatch batch;
+	{
+		PipelinedSeqReader reader(ChunkedBatchReader({"sample.fa"}, SeqFormat::FASTA, 100));
+		batch = reader.next(10);
+	}
+	REQUIRE(batch.size() == 2);
+	REQUIRE(batch[1].seq.size() == 300);
+
+	std::string text = "\n>r1 x\r\nacgT\r\n\n  nnRY \r\n>r2\n>r3\nAC";
+	std::vector<SeqView> records;
+	size_t n = ChunkedSeqReader::parse(&text[0], &text[0] + text.size(), false, SeqFormat::FASTA, records);
+	REQUIRE(records.size() == 2);
+	REQUIRE(records[0].id == ">r1 x");
+	REQUIRE(records[0].seq == "ACGTNNNN");
+	REQUIRE(records[1].id == ">r2");
+	REQUIRE(records[1].seq.empty());
+	REQUIRE(text.substr(n) == ">r3\nAC");
+	n += ChunkedSeqReader::parse(&text[0] + n, &text[0] + text.size(), true, SeqFormat::FASTA, records);
+	REQUIRE(n == text.size());
+	REQUIRE(records.size() == 3);
+	REQUIRE(records[2].seq == "AC");
+
+	std::string bad = "ACGT\n>r1\nACGT\n";
+	REQUIRE_THROWS(ChunkedSeqReader::parse(&bad[0], &bad[0] + bad.size(), true, SeqFormat::FASTA, records));
+	std::string truncated = "@r1\nACGT\n+\n";
+	REQUIRE_THROWS(ChunkedSeqReader::parse(&truncated[0], &truncated[0] + truncated.size(), true, SeqFormat::FASTQ,
+										   records));
+}
+
+TEST_CASE("read in shards", "[chunked]")
+{
+	struct Input
+	{
+		std::vector<std::string> files;
+		SeqFormat format;
+	};
+	for (auto &input : {Input{{"knucleotide.fasta", "sample.fa", "sample.fa.gz"}, SeqFormat::FASTA},
+						Input{{"sample.fq", "sample.fq.gz"}, SeqFormat::FASTQ},
+						Input{{"sample.txt"}, SeqFormat::LINE}})
+	{
+		ChunkedBatchReader reader(input.files, input.format);
+		SeqBatch expected = reader.next(1000);
+		REQUIRE(!expected.empty());
+
+		for (size_t min_bytes : {1, 100, 1 << 20})
+		{
+			std::vector<InputShard> shards = make_shards(input.files, 1000, min_bytes);
+			REQUIRE(shards.size() >= input.files.size());
+			size_t n = 0;
+			std::vector<SeqView> records;
+			std::shared_ptr<const void> owner;
+			for (auto &shard : shards)
+			{
+				ChunkedSeqReader shard_reader(shard, input.format, 64);
+				while (shard_reader.next(records, owner))
+				{
+					for (auto &r : records)
+					{
+						REQUIRE(n < expected.size());
+						REQUIRE(r.id == expected[n].id);
+						REQUIRE(r.seq == expected[n].seq);
+						n++;
+					}
+				}
+			}
+			REQUIRE(n == expected.size());
+		}
+	}
+}
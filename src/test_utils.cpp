@@ -2,9 +2,13 @@
 #include <stdexcept>
 #include <string>
 #include <algorithm>
+#include <cmath>
 
 #include "acutest.h"
 #include "utils.h"
+#include "corpus.h"
+#include "scheduler.h"
+#include "lr_schedule.h"
 
 using namespace std;
 using namespace sparc;
@@ -81,8 +85,147 @@ void test_split(void) {
 
 }
 
+void test_myrand(void) {
+	std::vector<double> a, b, c;
+	myrand::seed(42);
+	for (int i = 0; i < 100; i++) {
+		a.push_back(myrand::uniform<double>());
+	}
+	myrand::seed(42);
+	for (int i = 0; i < 100; i++) {
+		b.push_back(myrand::uniform<double>());
+	}
+	// another stream from the same seed
+	myrand::seed(42, 1);
+	for (int i = 0; i < 100; i++) {
+		c.push_back(myrand::uniform<double>());
+	}
+	TEST_CHECK(a == b);
+	TEST_CHECK(a != c);
+	for (int i = 0; i < 100; i++) {
+		TEST_CHECK(a[i] >= 0 && a[i] < 1);
+		float f = myrand::uniform<float>();
+		TEST_CHECK(f >= 0 && f < 1);
+		TEST_CHECK(myrand::uniform_int(7) < 7);
+	}
+}
+
+void test_corpus(void) {
+	std::vector<std::vector<uint32_t> > reads = { {1, 2, 3}, {}, {7}, {4, 5,
+			6, 8, 9}, {10, 11} };
+	// 1MB keeps everything in memory, 16 bytes spills at the 4th read
+	for (size_t budget : { (size_t) 1 << 20, (size_t) 16 }) {
+		HashedCorpus corpus(budget, "test_corpus.tmp");
+		for (auto &r : reads) {
+			corpus.append(r.data(), r.size());
+		}
+		corpus.finish();
+		TEST_CHECK(corpus.is_spilled() == (budget == 16));
+		TEST_CHECK(corpus.num_reads() == reads.size());
+		TEST_CHECK(corpus.num_tokens() == 11);
+		std::vector<uint32_t> r;
+		for (size_t i = 0; i < reads.size(); i++) {
+			corpus.get(i, r);
+			TEST_CHECK(r == reads[i]);
+		}
+		// the spill file is gone once mapped
+		TEST_CHECK(!file_exists("test_corpus.tmp"));
+	}
+}
+
+void test_corpus_file(void) {
+	// 13 bits do not divide 64, so ids cross word boundaries
+	std::vector<std::vector<uint32_t> > reads;
+	for (int i = 0; i < 50; i++) {
+		std::vector<uint32_t> r(myrand::uniform_int(20));
+		for (auto &x : r) {
+			x = myrand::uniform_int(1 << 13);
+		}
+		reads.push_back(r);
+	}
+	HashedCorpus corpus(1 << 20, "test_corpus.tmp");
+	for (auto &r : reads) {
+		corpus.append(r.data(), r.size());
+	}
+	corpus.finish();
+	for (bool bit_pack : { false, true }) {
+		corpus.save("test_corpus.bin", 11, 13, 1, 12345, bit_pack);
+		HashedCorpus loaded;
+		loaded.load("test_corpus.bin");
+		TEST_CHECK(loaded.get_header().bits == (bit_pack ? 13u : 32u));
+		TEST_CHECK(loaded.num_reads() == reads.size());
+		TEST_CHECK(loaded.num_tokens() == corpus.num_tokens());
+		std::vector<uint32_t> r;
+		for (size_t i = 0; i < reads.size(); i++) {
+			loaded.get(i, r);
+			TEST_CHECK(r == reads[i]);
+		}
+		loaded.verify(11, 13, 12345);
+		bool thrown = false;
+		try {
+			loaded.verify(11, 13, 54321);
+		} catch (const std::exception &e) {
+			thrown = true;
+		}
+		TEST_CHECK(thrown);
+	}
+	remove("test_corpus.bin");
+}
+
+void test_scheduler(void) {
+	// one heavy item and many light ones, every item runs exactly once
+	std::vector<size_t> weights(1000, 1);
+	weights[3] = 5000;
+	WorkStealingScheduler scheduler(4);
+	std::vector<int> runs(weights.size(), 0);
+	scheduler.run(weights, [&](size_t i) {
+#pragma omp atomic
+		runs[i]++;
+	});
+	TEST_CHECK(
+			std::all_of(runs.begin(), runs.end(), [](int n) {return n == 1;}));
+
+	scheduler.run(std::vector<size_t>(), [&](size_t i) {
+		runs[i]++;
+	});
+	std::vector<double> u = scheduler.utilization();
+	TEST_CHECK(u.size() == 4);
+	for (double x : u) {
+		TEST_CHECK(x >= 0 && x <= 100);
+	}
+}
+
+void test_lr_schedule(void) {
+	// constant until the total is known, then linear in the tokens
+	LearningRateSchedule token(LearningRateSchedule::PER_TOKEN, 0.4f, 0.01f);
+	TEST_CHECK(token.rate() == 0.4f);
+	token.advance(100);
+	token.set_total(400);
+	TEST_CHECK(std::abs(token.rate() - 0.3f) < 1e-6);
+	token.advance(300);
+	TEST_CHECK(token.rate() == 0.01f);
+	token.advance(100);
+	TEST_CHECK(token.rate() == 0.01f);
+
+	LearningRateSchedule epoch(LearningRateSchedule::PER_EPOCH, 0.4f, 0, 10);
+	epoch.start_epoch(1, 4);
+	TEST_CHECK(std::abs(epoch.rate() - 0.03f) < 1e-6);
+	epoch.advance(20);
+	TEST_CHECK(std::abs(epoch.rate() - 0.3f) < 1e-6);
+}
+
 TEST_LIST = { {"test_trim", test_trim},
 
 	{	"test_split", test_split},
+
+	{	"test_myrand", test_myrand},
+
+	{	"test_corpus", test_corpus},
+
+	{	"test_corpus_file", test_corpus_file},
+
+	{	"test_scheduler", test_scheduler},
+
+	{	"test_lr_schedule", test_lr_schedule},
 	{	NULL, NULL}};
 
@@ -1,10 +1,15 @@
-
+#include <memory>
+#include <atomic>
 #include "argagg.hpp"
 #include "utils.h"
 #include "CRandProj.h"
 #include "kmer.h"
 #include "io.h"
 #include "model.h"
+#include "corpus.h"
+#include "seqreader.h"
+#include "scheduler.h"
+#include "lr_schedule.h"
 #include "serialization.h"
 #include "config.h"
 #include "pbar.h"
@@ -13,28 +18,69 @@
 struct Config : public BaseConfig
 {
     float learning_rate;
+    float min_learning_rate;
+    uint64_t warmup_tokens;
     uint32_t epoch;
     uint32_t dim;
     uint32_t neg_size;
     uint32_t half_window;
+    uint32_t hash_block;
+    uint32_t minibatch;
+    int64_t seed;
+    double sample;
+    size_t cache_budget;
     size_t num_seq;
     std::string hash_file;
     std::string output_prefix;
+    std::string neg_sampler;
+    std::string loss;
+    std::string lr_decay;
+    std::string wc_file;
+    std::string corpus_file;
+    ValueType storage = ValueType::FP32;
+    ValueType vec_precision = ValueType::FP32;
     bool use_cbow = true;
+    bool shared_negatives = false;
     bool is_fasta = false;
     bool is_fastq = false;
+    bool huge_pages = false;
+    bool cache_corpus = false;
+    bool sharded = false;
+
+    SeqFormat seq_format() const
+    {
+        return is_fasta ? SeqFormat::FASTA : (is_fastq ? SeqFormat::FASTQ : SeqFormat::LINE);
+    }
 
     void print()
     {
         BaseConfig::print();
         myinfo("config: learning_rate=%f", learning_rate);
+        myinfo("config: min_learning_rate=%f", min_learning_rate);
+        myinfo("config: lr_decay=%s", lr_decay.c_str());
+        myinfo("config: warmup_tokens=%lu", warmup_tokens);
         myinfo("config: epoch=%ld", epoch);
         myinfo("config: dimension=%ld", dim);
         myinfo("config: neg_size=%ld", neg_size);
         myinfo("config: half_window=%ld", half_window);
         myinfo("config: hash_file=%s", hash_file.c_str());
+        myinfo("config: hash_block=%ld", hash_block);
+        myinfo("config: seed=%ld", seed);
+        myinfo("config: neg_sampler=%s", neg_sampler.c_str());
+        myinfo("config: loss=%s", loss.c_str());
+        myinfo("config: minibatch=%u", minibatch);
+        myinfo("config: sample=%g", sample);
+        myinfo("config: wc_file=%s", wc_file.c_str());
         myinfo("config: output_prefix=%s", output_prefix.c_str());
         myinfo("config: use_cbow=%s", use_cbow ? "true" : "false");
+        myinfo("config: shared_negatives=%s", shared_negatives ? "true" : "false");
+        myinfo("config: huge_pages=%s", huge_pages ? "true" : "false");
+        myinfo("config: storage=%s", value_type_name(storage));
+        myinfo("config: vec_precision=%s", value_type_name(vec_precision));
+        myinfo("config: corpus_file=%s", corpus_file.c_str());
+        myinfo("config: cache_corpus=%s", cache_corpus ? "true" : "false");
+        myinfo("config: cache_budget=%luMB", cache_budget >> 20);
+        myinfo("config: sharded=%s", sharded ? "true" : "false");
     }
 };
 
@@ -64,16 +110,36 @@ int main(int argc, char **argv)
 
         {"zip_output", {"-z", "--zip"}, "zip output files", 0},
         {"use_skipgram", {"--use-skipgram"}, "use skipgram (ohterwise cbow)", 0},
+        {"shared_negatives", {"--shared-negatives"}, "skipgram with negative sampling draws one negative set per center word for all its context words", 0},
         {"use_fasta", {"--fasta"}, "input are fasta files", 0},
         {"use_fastq", {"--fastq"}, "input are fastq files", 0},
+        {"huge_pages", {"--huge-pages"}, "back the embedding matrices with transparent huge pages", 0},
+        {"cache_corpus", {"--cache-corpus"}, "keep the hashed reads after the first epoch so later epochs skip reading and hashing", 0},
+        {"sharded", {"--sharded"}, "every thread reads its own input files or parts of files and trains on them without waiting for the others", 0},
 
         {"output", {"-o", "--output"}, "output model prefix (default 'model')", 1},
         {"hash_file", {"--hash-file"}, "hash file to use", 1},
+        {"corpus_file", {"--corpus"}, "train on a corpus file written by prehash instead of input files", 1},
         {"learning_rate", {
                               "--lr",
                           },
          "initial learning rate (default 0.3)",
          1},
+        {"min_learning_rate", {
+                                  "--min-lr",
+                              },
+         "the learning rate never decays below this (default 0)",
+         1},
+        {"lr_decay", {
+                         "--lr-decay",
+                     },
+         "learning rate decay, token (linear in the tokens trained so far) or epoch (one rate per epoch) (default token)",
+         1},
+        {"warmup_tokens", {
+                              "--warmup",
+                          },
+         "tokens over which the learning rate ramps up from 0 at the start (default 0)",
+         1},
 
         {"dim", {
                     "--dim",
@@ -96,6 +162,56 @@ int main(int argc, char **argv)
                   },
          "number of epochs to train (default 100)",
          1},
+        {"hash_block", {
+                           "--hash-block",
+                       },
+         "bases per hash table lookup, 1-4 (default 1 which is exact, larger is faster but may rarely change a bucket)",
+         1},
+        {"seed", {
+                     "--seed",
+                 },
+         "random seed (default from std::random_device)",
+         1},
+        {"neg_sampler", {
+                            "--neg-sampler",
+                        },
+         "negative sampler, uniform or unigram (default unigram, which draws from count^0.75 once the counts are known)",
+         1},
+        {"loss", {
+                     "--loss",
+                 },
+         "output layer, ns for negative sampling or hs for hierarchical softmax over a Huffman tree of the bucket counts, built once the counts are known (default ns)",
+         1},
+        {"minibatch", {
+                          "--minibatch",
+                      },
+         "train negative sampling in batches of this many samples that share their negatives, with matrix products. Learning rates above 0.5/sqrt(batch) are scaled down to it, together with --min-lr (default 0 which trains one sample at a time)",
+         1},
+        {"sample", {
+                       "--sample",
+                   },
+         "subsampling threshold for frequent buckets after the first epoch, e.g. 1e-4 (default 0 which is off)",
+         1},
+        {"cache_budget", {
+                             "--cache-budget",
+                         },
+         "MB of hashed reads kept in memory with --cache-corpus, the rest is spilled to a mmap'ed file next to the output (default 4096)",
+         1},
+        {"storage", {
+                        "--storage",
+                    },
+         "value type of the embedding tables, fp32, bf16 or fp16 (default fp32). bf16 and fp16 halve the memory, training still computes in fp32",
+         1},
+        {"vec_precision", {
+                              "--vec-precision",
+                          },
+         "value type of the output .vec.bin, fp32, bf16 or fp16 (default fp32)",
+         1},
+        {"wc_file", {
+                        "--wc-file",
+                    },
+         "word counts (.wc.txt) to build the unigram sampler or the Huffman tree from before the first epoch",
+         1},
         {"n_thread", {
                          "--thread",
                      },
@@ -137,14 +253,30 @@ int main(int argc, char **argv)
     config.backend = "smp";
     config.dim = args["dim"].as<uint32_t>(300);
     config.learning_rate = args["learning_rate"].as<float>(0.3);
+    config.min_learning_rate = args["min_learning_rate"].as<float>(0);
+    config.lr_decay = args["lr_decay"].as<std::string>("token");
+    config.warmup_tokens = args["warmup_tokens"].as<uint64_t>(0);
     config.epoch = args["epoch"].as<uint32_t>(100);
     config.neg_size = args["neg_size"].as<uint32_t>(5);
     config.half_window = args["half_window"].as<uint32_t>(5);
+    config.hash_block = args["hash_block"].as<uint32_t>(1);
+    config.seed = args["seed"].as<int64_t>(-1);
+    config.neg_sampler = args["neg_sampler"].as<std::string>("unigram");
+    config.loss = args["loss"].as<std::string>("ns");
+    config.minibatch = args["minibatch"].as<uint32_t>(0);
+    config.wc_file = args["wc_file"].as<std::string>("");
+    config.sample = args["sample"].as<double>(0);
 
     config.zip_output = args["zip_output"];
     config.is_fasta = args["use_fasta"];
     config.is_fastq = args["use_fastq"];
     config.use_cbow = !args["use_skipgram"];
+    config.shared_negatives = args["shared_negatives"];
+    config.huge_pages = args["huge_pages"];
+    config.cache_corpus = args["cache_corpus"];
+    config.sharded = args["sharded"];
+    config.corpus_file = args["corpus_file"].as<std::string>("");
+    config.cache_budget = args["cache_budget"].as<size_t>(4096) << 20;
     config.hash_file = args["hash_file"].as<std::string>();
 
     if (!sparc::file_exists(config.hash_file.c_str()))
@@ -153,7 +285,51 @@ int main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
-    if (args.pos.empty())
+    if (config.neg_sampler != "uniform" && config.neg_sampler != "unigram")
+    {
+        std::cerr << "unknown negative sampler: " << config.neg_sampler << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (config.loss != "ns" && config.loss != "hs")
+    {
+        std::cerr << "unknown loss: " << config.loss << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!parse_value_type(args["storage"].as<std::string>("fp32"), config.storage))
+    {
+        std::cerr << "unknown storage type: " << args["storage"].as<std::string>() << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!parse_value_type(args["vec_precision"].as<std::string>("fp32"), config.vec_precision))
+    {
+        std::cerr << "unknown vector precision: " << args["vec_precision"].as<std::string>() << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (config.lr_decay != "token" && config.lr_decay != "epoch")
+    {
+        std::cerr << "unknown learning rate decay: " << config.lr_decay << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!config.wc_file.empty() && !sparc::file_exists(config.wc_file.c_str()))
+    {
+        std::cerr << "word count file does not exists: " << config.wc_file << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (!config.corpus_file.empty())
+    {
+        if (!sparc::file_exists(config.corpus_file.c_str()))
+        {
+            std::cerr << "corpus file does not exists: " << config.corpus_file << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (!args.pos.empty())
+        {
+            std::cerr << "input files can not be used with --corpus" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    else if (args.pos.empty())
     {
         std::cerr << "no input files are provided" << std::endl;
         return EXIT_FAILURE;
@@ -185,23 +361,128 @@ int main(int argc, char **argv)
     return 0;
 }
 
-template <class BR>
-void run_epoch(uint32_t this_epoch, Config &config, BR &reader, SingleNodeModel<float> &model, rpns::CRandProj &hash, float learning_rate)
+// the bucket ids of one read, also added to the corpus if one is built
+inline void hash_seq(std::string_view seq, rpns::CRandProj &hash, HashedCorpus *corpus, std::vector<uint32_t> &kmers)
 {
-    myinfo("Start epoch %ld, learning_rate=%.6f", this_epoch + 1, learning_rate);
+    hash.hash_seq(seq, kmers);
+    if (corpus)
+    {
+#pragma omp critical(corpus)
+        try
+        {
+            corpus->append(kmers.data(), kmers.size());
+        }
+        catch (const std::exception &e)
+        {
+            myerror("%s", e.what());
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// hash one read and train on it
+template <typename STORAGE_TYPE>
+inline float train_seq(std::string_view seq, SingleNodeModel<float, STORAGE_TYPE> &model, rpns::CRandProj &hash,
+                       const Subsampler &subsampler, HashedCorpus *corpus, LearningRateSchedule &schedule, bool update_wc,
+                       size_t &n_token, size_t &n_trained)
+{
+    thread_local std::vector<uint32_t> kmers;
+    hash_seq(seq, hash, corpus, kmers);
+    n_token = kmers.size();
+    n_trained = subsampler.filter(kmers);
+    float loss = model.update(kmers, schedule.rate(), update_wc);
+    schedule.advance(n_trained);
+    return loss;
+}
+
+// reads with more tokens than this are trained in pieces
+static const size_t CHUNK_TOKENS = 1024;
+
+// a multiple of the window, so that the pieces of a read line up with it
+inline size_t chunk_tokens(const Config &config)
+{
+    size_t window = std::max<size_t>(2 * config.half_window, 1);
+    return (CHUNK_TOKENS + window - 1) / window * window;
+}
+
+/*
+ * Trains on hashed reads. Reads longer than chunk tokens are trained in
+ * pieces, and the pieces are balanced over the threads by their number of
+ * tokens, so one long read does not keep the other threads waiting. Every
+ * piece is trained with the learning rate of the schedule at its start.
+ * Returns the sum of the losses of the reads.
+ */
+template <typename STORAGE_TYPE>
+float train_reads(const std::vector<std::vector<uint32_t>> &tokens, SingleNodeModel<float, STORAGE_TYPE> &model,
+                  WorkStealingScheduler &scheduler, size_t chunk, LearningRateSchedule &schedule, bool update_wc)
+{
+    struct Piece
+    {
+        size_t read, begin, end;
+    };
+    std::vector<Piece> pieces;
+    std::vector<size_t> weights;
+    for (size_t r = 0; r < tokens.size(); r++)
+    {
+        for (size_t b = 0; b < tokens[r].size(); b += chunk)
+        {
+            pieces.push_back({r, b, std::min(tokens[r].size(), b + chunk)});
+            weights.push_back(pieces.back().end - b);
+        }
+    }
+    float sum_loss = 0;
+    scheduler.run(weights, [&](size_t i)
+                  {
+                      const Piece &p = pieces[i];
+                      const std::vector<uint32_t> &words = tokens[p.read];
+                      // the loss of a read is the mean over its pieces
+                      float loss = model.update(words, p.begin, p.end, schedule.rate(), update_wc) * (p.end - p.begin) / words.size();
+                      schedule.advance(p.end - p.begin);
+#pragma omp critical
+                      sum_loss += loss;
+                  });
+    return sum_loss;
+}
+
+void log_utilization(const std::vector<double> &percent)
+{
+    if (percent.empty())
+    {
+        return;
+    }
+    std::string s;
+    double mean = 0;
+    char buf[32];
+    for (double p : percent)
+    {
+        snprintf(buf, sizeof(buf), " %.0f%%", p);
+        s += buf;
+        mean += p;
+    }
+    myinfo("thread utilization:%s (mean %.1f%%)", s.c_str(), mean / percent.size());
+}
+
+template <class BR, typename STORAGE_TYPE>
+void run_epoch(uint32_t this_epoch, Config &config, BR &reader, SingleNodeModel<float, STORAGE_TYPE> &model, rpns::CRandProj &hash, const Subsampler &subsampler, HashedCorpus *corpus, WorkStealingScheduler &scheduler, LearningRateSchedule &schedule)
+{
+    myinfo("Start epoch %ld, learning_rate=%.6f", this_epoch + 1, schedule.rate());
 
     uint32_t batchsize = config.nprocs * 100;
-    uint32_t kmer_size = hash.get_kmer_size();
     bool update_wc = this_epoch == 0;
     float sum_loss = 0;
     size_t num_of_seq = 0;
+    size_t num_of_token = 0;
+    size_t num_of_trained = 0;
     char msg[128];
     sprintf(msg, "epoch %u:", this_epoch);
     PUnknownBar ubar(msg);
     PBar bar(msg, config.num_seq);
+    std::vector<std::vector<uint32_t>> tokens;
+    std::vector<size_t> weights;
+    scheduler.reset_utilization();
     while (true)
     {
-        std::vector<FastaRecord> v = reader.next(batchsize);
+        SeqBatch v = reader.next(batchsize);
         sparc::shuffle(v);
         num_of_seq += v.size();
         if (v.empty())
@@ -209,82 +490,396 @@ void run_epoch(uint32_t this_epoch, Config &config, BR &reader, SingleNodeModel<
             break;
         }
 
-#pragma omp parallel for
+        // hashing, weighted by read length
+        tokens.resize(v.size());
+        weights.resize(v.size());
         for (size_t i = 0; i < v.size(); i++)
         {
-            std::string &seq = v.at(i).seq;
+            weights[i] = v[i].seq.size();
+        }
+        scheduler.run(weights, [&](size_t i)
+                      {
+                          hash_seq(v[i].seq, hash, corpus, tokens[i]);
+                          size_t n_token = tokens[i].size();
+                          size_t n_trained = subsampler.filter(tokens[i]);
+                          if (this_epoch == 0)
+                          {
+                              ubar.tick();
+                          }
+                          else
+                          {
+                              bar.tick();
+                          }
+#pragma omp critical
+                          {
+                              num_of_token += n_token;
+                              num_of_trained += n_trained;
+                          }
+                      });
+        sum_loss += train_reads(tokens, model, scheduler, chunk_tokens(config), schedule, update_wc);
+    }
+    if (this_epoch == 0)
+    {
+        ubar.end();
+    }
+    else
+    {
+        bar.end();
+    }
 
-            auto strkmers = generate_kmer_for_fastseq(seq, kmer_size, "N", true);
-            std::vector<uint32_t> kmers;
-            for (auto &strkmer : strkmers)
-            {
-                kmers.push_back(hash.hash(strkmer, false));
-            }
+    if (this_epoch == 0)
+    {
+        myinfo("Found that number of sequences is %ld", num_of_seq);
+        config.num_seq = num_of_seq;
+    }
+
+    myinfo("End epoch %ld, loss=%f, tokens=%lu, trained=%lu (%.1f%%)", this_epoch + 1, num_of_seq == 0 ? 0 : sum_loss / num_of_seq,
+           num_of_token, num_of_trained, num_of_token == 0 ? 0.0 : 100.0 * num_of_trained / num_of_token);
+    log_utilization(scheduler.utilization());
+}
 
-            float loss = model.update(kmers, learning_rate, update_wc);
-            if (this_epoch == 0)
+/*
+ * Same as run_epoch, but every thread takes whole shards of the input and
+ * parses, hashes and trains on them by itself (Hogwild on the shared
+ * model), so threads only wait for each other at the end of the epoch.
+ */
+template <typename STORAGE_TYPE>
+void run_epoch(uint32_t this_epoch, Config &config, const std::vector<InputShard> &shards, SingleNodeModel<float, STORAGE_TYPE> &model, rpns::CRandProj &hash, const Subsampler &subsampler, HashedCorpus *corpus, LearningRateSchedule &schedule)
+{
+    myinfo("Start epoch %ld, learning_rate=%.6f", this_epoch + 1, schedule.rate());
+
+    bool update_wc = this_epoch == 0;
+    float sum_loss = 0;
+    size_t num_of_seq = 0;
+    size_t num_of_token = 0;
+    size_t num_of_trained = 0;
+    char msg[128];
+    sprintf(msg, "epoch %u:", this_epoch);
+    PUnknownBar ubar(msg);
+    PBar bar(msg, config.num_seq);
+    std::atomic<size_t> next_shard(0);
+    std::vector<double> busy(omp_get_max_threads(), 0);
+    double start = omp_get_wtime();
+#pragma omp parallel reduction(+ : sum_loss, num_of_seq, num_of_token, num_of_trained)
+    {
+        double t0 = omp_get_wtime();
+        std::vector<SeqView> records;
+        std::shared_ptr<const void> owner;
+        for (size_t s = next_shard++; s < shards.size(); s = next_shard++)
+        {
+            try
             {
-                ubar.tick();
+                ChunkedSeqReader reader(shards[s], config.seq_format());
+                while (reader.next(records, owner))
+                {
+                    for (auto &record : records)
+                    {
+                        size_t n_token, n_trained;
+                        sum_loss += train_seq(record.seq, model, hash, subsampler, corpus, schedule,
+                                              update_wc, n_token, n_trained);
+                        num_of_seq++;
+                        num_of_token += n_token;
+                        num_of_trained += n_trained;
+                        if (this_epoch == 0)
+                        {
+                            ubar.tick();
+                        }
+                        else
+                        {
+                            bar.tick();
+                        }
+                    }
+                }
             }
-            else
+            catch (const std::exception &e)
             {
-                bar.tick();
+                myerror("%s", e.what());
+                exit(EXIT_FAILURE);
             }
-#pragma omp critical
-            sum_loss += loss;
         }
+        busy[omp_get_thread_num()] = omp_get_wtime() - t0;
+    }
+    double wall = omp_get_wtime() - start;
+    for (double &b : busy)
+    {
+        b = wall > 0 ? std::min(100.0, 100.0 * b / wall) : 0;
     }
     if (this_epoch == 0)
     {
         ubar.end();
+        myinfo("Found that number of sequences is %ld", num_of_seq);
+        config.num_seq = num_of_seq;
     }
     else
     {
         bar.end();
     }
 
+    myinfo("End epoch %ld, loss=%f, tokens=%lu, trained=%lu (%.1f%%)", this_epoch + 1, num_of_seq == 0 ? 0 : sum_loss / num_of_seq,
+           num_of_token, num_of_trained, num_of_token == 0 ? 0.0 : 100.0 * num_of_trained / num_of_token);
+    log_utilization(busy);
+}
+
+// same as run_epoch, but the reads come hashed from a corpus file or cache
+template <typename STORAGE_TYPE>
+void run_epoch(uint32_t this_epoch, Config &config, const HashedCorpus &corpus, SingleNodeModel<float, STORAGE_TYPE> &model, const Subsampler &subsampler, WorkStealingScheduler &scheduler, LearningRateSchedule &schedule)
+{
+    myinfo("Start epoch %ld, learning_rate=%.6f", this_epoch + 1, schedule.rate());
+
+    size_t batchsize = config.nprocs * 100;
+    size_t num_reads = corpus.num_reads();
+    bool update_wc = this_epoch == 0;
+    float sum_loss = 0;
+    size_t num_of_token = 0;
+    size_t num_of_trained = 0;
+    char msg[128];
+    sprintf(msg, "epoch %u:", this_epoch);
+    PBar bar(msg, num_reads);
+    std::vector<size_t> order;
+    std::vector<std::vector<uint32_t>> tokens;
+    std::vector<size_t> weights;
+    scheduler.reset_utilization();
+    for (size_t start = 0; start < num_reads; start += batchsize)
+    {
+        size_t end = std::min(start + batchsize, num_reads);
+        order.resize(end - start);
+        for (size_t i = start; i < end; i++)
+        {
+            order[i - start] = i;
+        }
+        sparc::shuffle(order);
+
+        tokens.resize(order.size());
+        weights.resize(order.size());
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            weights[i] = corpus.length(order[i]);
+        }
+        scheduler.run(weights, [&](size_t i)
+                      {
+                          corpus.get(order[i], tokens[i]);
+                          size_t n_token = tokens[i].size();
+                          size_t n_trained = subsampler.filter(tokens[i]);
+                          bar.tick();
+#pragma omp critical
+                          {
+                              num_of_token += n_token;
+                              num_of_trained += n_trained;
+                          }
+                      });
+        sum_loss += train_reads(tokens, model, scheduler, chunk_tokens(config), schedule, update_wc);
+    }
+    bar.end();
+
     if (this_epoch == 0)
     {
-        myinfo("Found that number of sequences is %ld", num_of_seq);
-        config.num_seq = num_of_seq;
+        config.num_seq = num_reads;
     }
 
-    myinfo("End epoch %ld, loss=%f", this_epoch + 1, num_of_seq == 0 ? 0 : sum_loss / num_of_seq);
+    myinfo("End epoch %ld, loss=%f, tokens=%lu, trained=%lu (%.1f%%)", this_epoch + 1, num_reads == 0 ? 0 : sum_loss / num_reads,
+           num_of_token, num_of_trained, num_of_token == 0 ? 0.0 : 100.0 * num_of_trained / num_of_token);
+    log_utilization(scheduler.utilization());
 }
 
-void run(Config &config)
+template <typename STORAGE_TYPE>
+void train(Config &config)
 {
     omp_set_num_threads(config.nprocs);
     rpns::CRandProj hash;
-    hash.load(config.hash_file);
+    if (hash.load(config.hash_file) != 0)
+    {
+        myerror("load rp hash failed: %s", config.hash_file.c_str());
+        exit(EXIT_FAILURE);
+    }
+    if (config.hash_block != 1 && hash.compile(config.hash_block) != 0)
+    {
+        myerror("failed to compile hash with hash_block=%u", config.hash_block);
+        exit(EXIT_FAILURE);
+    }
+
+    if (config.seed >= 0)
+    {
+        sparc::myrand::seed((uint64_t)config.seed);
+    }
 
     size_t num_word = 1l << hash.get_hash_size();
     myinfo("kmer_size=%lu, hash_size=%lu, num_word=%lu", hash.get_kmer_size(), hash.get_hash_size(), num_word);
-    SingleNodeModel<float> model(num_word, config.dim, config.neg_size, config.use_cbow, config.half_window);
+    SingleNodeModel<float, STORAGE_TYPE> model(num_word, config.dim, config.neg_size, config.use_cbow, config.half_window, config.huge_pages);
     //model.randomize_init();
     model.uniform_init();
+    model.set_minibatch(config.minibatch);
+    float lr_scale = 1;
+    if (config.minibatch > 0 && config.learning_rate > MinibatchKernel<float, decltype(model)>::max_lr(config.minibatch))
+    {
+        // the whole schedule, so a decaying rate keeps its shape
+        lr_scale = MinibatchKernel<float, decltype(model)>::max_lr(config.minibatch) / config.learning_rate;
+        mywarn("the learning rate schedule is scaled by %g to start at %g with --minibatch %u, larger rates diverge",
+               lr_scale, config.learning_rate * lr_scale, config.minibatch);
+    }
+    model.set_shared_negatives(config.shared_negatives);
+
+    Subsampler subsampler(config.sample);
+    std::unique_ptr<HashedCorpus> corpus;
+    if (!config.corpus_file.empty())
+    {
+        corpus.reset(new HashedCorpus());
+        try
+        {
+            corpus->load(config.corpus_file);
+            corpus->verify(hash.get_kmer_size(), hash.get_hash_size(), HashedCorpus::checksum_file(config.hash_file));
+        }
+        catch (const std::exception &e)
+        {
+            myerror("%s", e.what());
+            exit(EXIT_FAILURE);
+        }
+        myinfo("corpus %s: %lu reads, %lu tokens, hash_block=%u", config.corpus_file.c_str(), corpus->num_reads(),
+               corpus->num_tokens(), corpus->get_header().hash_block);
+    }
+    else if (config.cache_corpus && config.epoch > 1)
+    {
+        corpus.reset(new HashedCorpus(config.cache_budget, config.output_prefix + ".corpus.tmp"));
+    }
+    // hierarchical softmax trains the first epoch with negative sampling,
+    // until the counts for the tree are known
+    bool use_hs = config.loss == "hs";
+    bool use_unigram = !use_hs && config.neg_sampler == "unigram";
+    if ((use_unigram || use_hs) && !config.wc_file.empty())
+    {
+        std::vector<uint32_t> counts;
+        try
+        {
+            counts = NegativeSampler::read_word_counts(config.wc_file, num_word);
+        }
+        catch (const std::exception &e)
+        {
+            myerror("%s", e.what());
+            exit(EXIT_FAILURE);
+        }
+        if (use_hs)
+        {
+            if (model.build_huffman_tree(counts))
+            {
+                myinfo("huffman tree built from %s over %u buckets, mean path length %.2f", config.wc_file.c_str(),
+                       model.get_tree().num_leaves(), model.get_tree().mean_depth());
+            }
+            else
+            {
+                mywarn("too few buckets in %s, using negative sampling for the first epoch", config.wc_file.c_str());
+            }
+        }
+        else if (model.build_unigram_sampler(counts))
+        {
+            myinfo("unigram sampler built from %s over %lu buckets", config.wc_file.c_str(), model.get_sampler().support());
+        }
+        else
+        {
+            mywarn("too few buckets in %s, sampling negatives uniformly", config.wc_file.c_str());
+        }
+    }
+
+    WorkStealingScheduler scheduler(config.nprocs);
+
+    // a few shards per thread, so that threads finishing early find more work
+    const std::vector<InputShard> shards = config.sharded && config.corpus_file.empty()
+                                               ? make_shards(config.inputpath, 4 * config.nprocs)
+                                               : std::vector<InputShard>();
+    if (!shards.empty())
+    {
+        myinfo("input split into %lu shards", shards.size());
+    }
+
+    LearningRateSchedule schedule(config.lr_decay == "epoch" ? LearningRateSchedule::PER_EPOCH : LearningRateSchedule::PER_TOKEN,
+                                  config.learning_rate * lr_scale, config.min_learning_rate * lr_scale, config.warmup_tokens);
+    if (corpus && corpus->is_finished())
+    {
+        // until the first epoch tells how many tokens subsampling keeps
+        schedule.set_total(corpus->num_tokens() * config.epoch);
+    }
+
     for (uint32_t i = 0; i < config.epoch; i++)
     {
-        float learning_rate = config.learning_rate * (config.epoch - i) / config.epoch;
+        schedule.start_epoch(i, config.epoch);
 
-        if (config.is_fasta)
+        if (corpus && corpus->is_finished())
         {
-            BatchReader<FastaTextReaderBase, FastaRecord> reader(config.inputpath);
-            run_epoch(i, config, reader, model, hash, learning_rate);
+            run_epoch(i, config, *corpus, model, subsampler, scheduler, schedule);
         }
-        else if (config.is_fastq)
+        else if (!shards.empty())
         {
-            BatchReader<FastqTextReaderBase, FastaRecord> reader(config.inputpath);
-            run_epoch(i, config, reader, model, hash, learning_rate);
+            run_epoch(i, config, shards, model, hash, subsampler, corpus.get(), schedule);
         }
         else
         {
-            BatchReader<SeqTextReaderBase, FastaRecord> reader(config.inputpath);
-            run_epoch(i, config, reader, model, hash, learning_rate);
+            PipelinedSeqReader reader(ChunkedBatchReader(config.inputpath, config.seq_format()));
+            run_epoch(i, config, reader, model, hash, subsampler, corpus.get(), scheduler, schedule);
+        }
+
+        if (i == 0 && use_unigram && model.get_sampler().get_kind() == NegativeSampler::UNIFORM)
+        {
+            if (model.build_unigram_sampler())
+            {
+                myinfo("unigram sampler built over %lu buckets", model.get_sampler().support());
+            }
+            else
+            {
+                mywarn("too few buckets were seen, sampling negatives uniformly");
+            }
+        }
+        if (i == 0 && use_hs && model.get_tree().empty())
+        {
+            if (model.build_huffman_tree())
+            {
+                myinfo("huffman tree built over %u buckets, mean path length %.2f", model.get_tree().num_leaves(), model.get_tree().mean_depth());
+            }
+            else
+            {
+                mywarn("too few buckets were seen, keeping negative sampling");
+            }
+        }
+        if (i == 0 && corpus && config.corpus_file.empty())
+        {
+            try
+            {
+                corpus->finish();
+            }
+            catch (const std::exception &e)
+            {
+                myerror("%s", e.what());
+                exit(EXIT_FAILURE);
+            }
+            myinfo("cached %lu reads, %lu tokens%s", corpus->num_reads(), corpus->num_tokens(), corpus->is_spilled() ? " (spilled to disk)" : "");
+        }
+        // epoch 0 trains on every token so that the word counts are exact
+        if (i == 0 && subsampler.build(model.get_word_count()))
+        {
+            myinfo("subsampling frequent buckets with t=%g", config.sample);
+        }
+        if (i == 0)
+        {
+            // the first epoch trains on every token, the others on what subsampling keeps
+            uint64_t per_epoch = schedule.get_done();
+            double kept = subsampler.kept_fraction(model.get_word_count());
+            schedule.set_total(per_epoch + (uint64_t)(per_epoch * kept * (config.epoch - 1)));
         }
     }
 
-    save_vector_bin(config.epoch, config.output_prefix, model, config.zip_output);
+    save_vector_bin(config.epoch, config.output_prefix, model, config.zip_output, config.vec_precision);
     save_wordcounts(config.epoch, config.output_prefix, model, config.zip_output);
     myinfo("Finished!");
 }
+
+void run(Config &config)
+{
+    switch (config.storage)
+    {
+    case ValueType::BF16:
+        train<bf16_t>(config);
+        break;
+    case ValueType::FP16:
+        train<fp16_t>(config);
+        break;
+    default:
+        train<float>(config);
+    }
+}
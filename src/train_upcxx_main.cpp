@@ -40,9 +40,15 @@ struct Config : public BaseConfig
 	uint32_t dim;
 	uint32_t neg_size;
 	uint32_t half_window;
+	uint32_t hash_block;
+	int64_t seed;
+	double sample;
 	size_t num_seq;
 	std::string hash_file;
+	std::string neg_sampler;
+	std::string loss;
 	bool use_cbow = true;
+	bool shared_negatives = false;
 	bool is_fasta = false;
 	bool is_fastq = false;
 
@@ -55,7 +61,13 @@ struct Config : public BaseConfig
 		myinfo("config: neg_size=%ld", neg_size);
 		myinfo("config: half_window=%ld", half_window);
 		myinfo("config: hash_file=%s", hash_file.c_str());
+		myinfo("config: hash_block=%ld", hash_block);
+		myinfo("config: seed=%ld", seed);
+		myinfo("config: neg_sampler=%s", neg_sampler.c_str());
+		myinfo("config: loss=%s", loss.c_str());
+		myinfo("config: sample=%g", sample);
 		myinfo("config: use_cbow=%s", use_cbow ? "true" : "false");
+		myinfo("config: shared_negatives=%s", shared_negatives ? "true" : "false");
 	}
 };
 
@@ -101,6 +113,7 @@ int main(int argc, char **argv)
 
 		{"zip_output", {"-z", "--zip"}, "zip output files", 0},
 		{"use_skipgram", {"--use-skipgram"}, "use skipgram (ohterwise cbow)", 0},
+		{"shared_negatives", {"--shared-negatives"}, "skipgram with negative sampling draws one negative set per center word for all its context words", 0},
 		{"use_fasta", {"--fasta"}, "input are fasta files", 0},
 		{"use_fastq", {"--fastq"}, "input are fastq files", 0},
 
@@ -133,6 +146,31 @@ int main(int argc, char **argv)
 				  },
 		 "number of epochs to train (default 100)",
 		 1},
+		{"hash_block", {
+						   "--hash-block",
+					   },
+		 "bases per hash table lookup, 1-4 (default 1 which is exact, larger is faster but may rarely change a bucket)",
+		 1},
+		{"seed", {
+					 "--seed",
+				 },
+		 "random seed (default from std::random_device)",
+		 1},
+		{"neg_sampler", {
+							"--neg-sampler",
+						},
+		 "negative sampler, uniform or unigram (default unigram, which draws from count^0.75 after the first epoch)",
+		 1},
+		{"loss", {
+					 "--loss",
+				 },
+		 "output layer, ns for negative sampling or hs for hierarchical softmax over a Huffman tree of the bucket counts, built after the first epoch (default ns)",
+		 1},
+		{"sample", {
+					   "--sample",
+				   },
+		 "subsampling threshold for frequent buckets after the first epoch, e.g. 1e-4 (default 0 which is off)",
+		 1},
 
 	}};
 
@@ -167,11 +205,17 @@ int main(int argc, char **argv)
 	config.epoch = args["epoch"].as<uint32_t>(100);
 	config.neg_size = args["neg_size"].as<uint32_t>(5);
 	config.half_window = args["half_window"].as<uint32_t>(5);
+	config.hash_block = args["hash_block"].as<uint32_t>(1);
+	config.seed = args["seed"].as<int64_t>(-1);
+	config.neg_sampler = args["neg_sampler"].as<std::string>("unigram");
+	config.loss = args["loss"].as<std::string>("ns");
+	config.sample = args["sample"].as<double>(0);
 
 	config.zip_output = args["zip_output"];
 	config.is_fasta = args["use_fasta"];
 	config.is_fastq = args["use_fastq"];
 	config.use_cbow = !args["use_skipgram"];
+	config.shared_negatives = args["shared_negatives"];
 	config.hash_file = args["hash_file"].as<std::string>();
 
 	if (!sparc::file_exists(config.hash_file.c_str()))
@@ -180,6 +224,17 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
+	if (config.neg_sampler != "uniform" && config.neg_sampler != "unigram")
+	{
+		std::cerr << "unknown negative sampler: " << config.neg_sampler << std::endl;
+		return EXIT_FAILURE;
+	}
+	if (config.loss != "ns" && config.loss != "hs")
+	{
+		std::cerr << "unknown loss: " << config.loss << std::endl;
+		return EXIT_FAILURE;
+	}
+
 	if (args.pos.empty())
 	{
 		std::cerr << "no input files are provided" << endl;
@@ -237,7 +292,7 @@ int main(int argc, char **argv)
 rpns::CRandProj g_hash;
 
 template <class BR>
-void run_epoch(uint32_t this_epoch, Config &config, BR &reader, UPCXXModel<float> &model, rpns::CRandProj &hash, float learning_rate)
+void run_epoch(uint32_t this_epoch, Config &config, BR &reader, UPCXXModel<float> &model, rpns::CRandProj &hash, const Subsampler &subsampler, float learning_rate)
 {
 	if (config.rank == 0)
 	{
@@ -245,10 +300,11 @@ void run_epoch(uint32_t this_epoch, Config &config, BR &reader, UPCXXModel<float
 	}
 
 	uint32_t batchsize = 10;
-	uint32_t kmer_size = hash.get_kmer_size();
 	bool update_wc = this_epoch == 0;
 	float sum_loss = 0;
 	size_t num_of_seq = 0;
+	size_t num_of_token = 0;
+	size_t num_of_trained = 0;
 	char msg[128];
 	sprintf(msg, "epoch %u:", this_epoch);
 	PUnknownBar *ubar = 0;
@@ -272,12 +328,10 @@ void run_epoch(uint32_t this_epoch, Config &config, BR &reader, UPCXXModel<float
 		{
 			std::string &seq = v.at(i).seq;
 
-			auto strkmers = generate_kmer_for_fastseq(seq, kmer_size, "N", true);
 			std::vector<uint32_t> kmers;
-			for (auto &strkmer : strkmers)
-			{
-				kmers.push_back(hash.hash(strkmer, false));
-			}
+			hash.hash_seq(seq, kmers);
+			num_of_token += kmers.size();
+			num_of_trained += subsampler.filter(kmers);
 
 			float loss = model.update(kmers, learning_rate, update_wc);
 			if (config.rank == 0)
@@ -312,6 +366,8 @@ void run_epoch(uint32_t this_epoch, Config &config, BR &reader, UPCXXModel<float
 
 	float mean_loss = num_of_seq == 0 ? 0 : sum_loss / num_of_seq;
 	int all_sum_loss = upcxx::reduce_all(mean_loss, upcxx_op_add).wait();
+	size_t all_token = upcxx::reduce_all(num_of_token, upcxx_op_add).wait();
+	size_t all_trained = upcxx::reduce_all(num_of_trained, upcxx_op_add).wait();
 
 	if (this_epoch == 0)
 	{
@@ -323,7 +379,8 @@ void run_epoch(uint32_t this_epoch, Config &config, BR &reader, UPCXXModel<float
 		{
 			myinfo("Found that number of sequences is %ld", num_of_seq);
 		}
-		myinfo("End epoch %ld, loss=%f", this_epoch + 1, mean_loss);
+		myinfo("End epoch %ld, loss=%f, tokens=%lu, trained=%lu (%.1f%%)", this_epoch + 1, mean_loss,
+			   all_token, all_trained, all_token == 0 ? 0.0 : 100.0 * all_trained / all_token);
 	}
 }
 
@@ -343,6 +400,11 @@ int run(const std::vector<std::string> &input, Config &config)
 			std::cerr << "load rp hash failed\n";
 			return EXIT_FAILURE;
 		}
+		else if (config.hash_block != 1 && g_hash.compile(config.hash_block) != 0)
+		{
+			std::cerr << "failed to compile hash with hash_block=" << config.hash_block << "\n";
+			return EXIT_FAILURE;
+		}
 		else
 		{
 			if (config.rank == 0)
@@ -352,9 +414,17 @@ int run(const std::vector<std::string> &input, Config &config)
 		}
 	}
 
+	if (config.seed >= 0)
+	{
+		// one stream per rank
+		sparc::myrand::seed((uint64_t)config.seed, config.rank);
+	}
+
 	uint32_t num_word = (uint32_t)(1l << g_hash.get_hash_size());
 	UPCXXModel<float> model(num_word, config.rank, config.nprocs, config.dim, config.neg_size, config.use_cbow, config.half_window);
 	model.uniform_init();
+	model.set_shared_negatives(config.shared_negatives);
+	Subsampler subsampler(config.sample);
 
 	for (uint32_t i = 0; i < config.epoch; i++)
 	{
@@ -362,18 +432,55 @@ int run(const std::vector<std::string> &input, Config &config)
 
 		if (config.is_fasta)
 		{
-			BatchReader<FastaTextReaderBase, FastaRecord> reader(input);
-			run_epoch(i, config, reader, model, g_hash, learning_rate);
+			PipelinedBatchReader<FastaTextReaderBase, FastaRecord> reader(input);
+			run_epoch(i, config, reader, model, g_hash, subsampler, learning_rate);
 		}
 		else if (config.is_fastq)
 		{
-			BatchReader<FastqTextReaderBase, FastaRecord> reader(input);
-			run_epoch(i, config, reader, model, g_hash, learning_rate);
+			PipelinedBatchReader<FastqTextReaderBase, FastaRecord> reader(input);
+			run_epoch(i, config, reader, model, g_hash, subsampler, learning_rate);
 		}
 		else
 		{
-			BatchReader<SeqTextReaderBase, FastaRecord> reader(input);
-			run_epoch(i, config, reader, model, g_hash, learning_rate);
+			PipelinedBatchReader<SeqTextReaderBase, FastaRecord> reader(input);
+			run_epoch(i, config, reader, model, g_hash, subsampler, learning_rate);
+		}
+
+		if (i == 0 && config.loss == "hs")
+		{
+			// the first epoch was trained with negative sampling
+			bool built = model.build_huffman_tree();
+			if (config.rank == 0)
+			{
+				if (built)
+				{
+					myinfo("huffman tree built over %u buckets, mean path length %.2f", model.get_tree().num_leaves(), model.get_tree().mean_depth());
+				}
+				else
+				{
+					mywarn("too few buckets were seen, keeping negative sampling");
+				}
+			}
+		}
+		else if (i == 0 && config.neg_sampler == "unigram")
+		{
+			bool built = model.build_unigram_sampler();
+			if (config.rank == 0)
+			{
+				if (built)
+				{
+					myinfo("unigram sampler built over %lu buckets", model.get_sampler().support());
+				}
+				else
+				{
+					mywarn("too few buckets were seen, sampling negatives uniformly");
+				}
+			}
+		}
+		// epoch 0 trains on every token so that the word counts are exact
+		if (i == 0 && config.sample > 0 && subsampler.build(model.gather_word_count()) && config.rank == 0)
+		{
+			myinfo("subsampling frequent buckets with t=%g", config.sample);
 		}
 	}
 
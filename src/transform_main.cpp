@@ -5,6 +5,8 @@
 #include "kmer.h"
 #include "io.h"
 #include "model.h"
+#include "corpus.h"
+#include "seqreader.h"
 #include "serialization.h"
 #include "config.h"
 #include "pbar.h"
@@ -15,15 +17,24 @@ struct Config : public BaseConfig
     std::string hash_file;
     std::string output_prefix;
     std::string model_path;
+    std::string corpus_file;
+    uint32_t hash_block;
     bool is_fasta = false;
     bool is_fastq = false;
 
+    SeqFormat seq_format() const
+    {
+        return is_fasta ? SeqFormat::FASTA : (is_fastq ? SeqFormat::FASTQ : SeqFormat::LINE);
+    }
+
     void print()
     {
         BaseConfig::print();
         myinfo("config: hash_file=%s", hash_file.c_str());
+        myinfo("config: hash_block=%ld", hash_block);
         myinfo("config: output_file=%s", output_prefix.c_str());
         myinfo("config: model_path=%s", model_path.c_str());
+        myinfo("config: corpus_file=%s", corpus_file.c_str());
     }
 };
 
@@ -59,7 +70,13 @@ int main(int argc, char **argv)
         {"output", {"-o", "--output"}, "output file (default out.txt)", 1},
         {"vec_path", {"--vec"}, "vector file (binary) path", 1},
         {"hash_file", {"--hash-file"}, "hash file to use", 1},
+        {"corpus_file", {"--corpus"}, "transform the reads of a corpus file written by prehash instead of input files", 1},
 
+        {"hash_block", {
+                           "--hash-block",
+                       },
+         "bases per hash table lookup, must match training (default 1)",
+         1},
         {"n_thread", {
                          "--thread",
                      },
@@ -99,12 +116,14 @@ int main(int argc, char **argv)
         config.nprocs = sparc::get_number_of_thread();
     }
     config.backend = "smp";
+    config.hash_block = args["hash_block"].as<uint32_t>(1);
 
     config.zip_output = args["zip_output"];
     config.is_fasta = args["use_fasta"];
     config.is_fastq = args["use_fastq"];
     config.hash_file = args["hash_file"].as<std::string>();
     config.model_path = args["vec_path"].as<std::string>();
+    config.corpus_file = args["corpus_file"].as<std::string>("");
 
     if (!sparc::file_exists(config.hash_file.c_str()))
     {
@@ -117,7 +136,20 @@ int main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
-    if (args.pos.empty())
+    if (!config.corpus_file.empty())
+    {
+        if (!sparc::file_exists(config.corpus_file.c_str()))
+        {
+            std::cerr << "corpus file does not exists: " << config.corpus_file << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (!args.pos.empty())
+        {
+            std::cerr << "input files can not be used with --corpus" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    else if (args.pos.empty())
     {
         std::cerr << "no input files are provided" << std::endl;
         return EXIT_FAILURE;
@@ -149,7 +181,7 @@ int main(int argc, char **argv)
     return 0;
 }
 
-void transform(const std::vector<uint32_t> &kmers, const std::vector<Vector<float>> &vecbin, Vector<float> &vec)
+void transform(const std::vector<uint32_t> &kmers, const Matrix<float> &vecbin, Vector<float> &vec)
 {
     vec.zero();
     if (kmers.empty())
@@ -158,7 +190,11 @@ void transform(const std::vector<uint32_t> &kmers, const std::vector<Vector<floa
     }
     for (uint32_t kmer : kmers)
     {
-        vec.add(vecbin.at(kmer));
+        if (kmer >= vecbin.get_rows())
+        {
+            throw std::out_of_range("kmer is out of range of the vectors, wrong hash file?");
+        }
+        vec.add(vecbin.row(kmer));
     }
     vec.mul(1.0f / kmers.size());
 }
@@ -169,18 +205,17 @@ void run(Config &config, BR &reader, rpns::CRandProj &hash, OS &os)
 
     std::string modelpath = config.model_path;
     myinfo("reading vectors from %s\n", modelpath.c_str());
-    std::vector<Vector<float>> wi;
+    Matrix<float> wi;
     read_vec_bin(modelpath, wi);
-    uint32_t dim = (uint32_t)wi.at(0).get_dim();
-    myinfo("finish reading %lu vectors[dim=%u] from %s\n", wi.size(), dim, modelpath.c_str());
+    uint32_t dim = wi.get_dim();
+    myinfo("finish reading %u vectors[dim=%u] from %s\n", wi.get_rows(), dim, modelpath.c_str());
 
     uint32_t batchsize = config.nprocs * 100;
-    uint32_t kmer_size = hash.get_kmer_size();
     PUnknownBar ubar("transform:");
     size_t count = 0;
     while (true)
     {
-        std::vector<FastaRecord> v = reader.next(batchsize);
+        SeqBatch v = reader.next(batchsize);
         count += v.size();
         if (v.empty())
         {
@@ -192,14 +227,10 @@ void run(Config &config, BR &reader, rpns::CRandProj &hash, OS &os)
 #pragma omp parallel for
         for (size_t i = 0; i < v.size(); i++)
         {
-            std::string &seq = v.at(i).seq;
+            std::string_view seq = v.at(i).seq;
 
-            auto strkmers = generate_kmer_for_fastseq(seq, kmer_size, "N", true);
-            std::vector<uint32_t> kmers;
-            for (auto &strkmer : strkmers)
-            {
-                kmers.push_back(hash.hash(strkmer, false));
-            }
+            thread_local std::vector<uint32_t> kmers;
+            hash.hash_seq(seq, kmers);
             Vector<float> vec(dim);
             transform(kmers, wi, vec);
             ubar.tick();
@@ -215,6 +246,43 @@ void run(Config &config, BR &reader, rpns::CRandProj &hash, OS &os)
     myinfo("Finished transforming %ld sequences", count);
 }
 
+// the reads of a corpus file, already hashed and in input order
+template <typename OS>
+void run(Config &config, const HashedCorpus &corpus, rpns::CRandProj &, OS &os)
+{
+    std::string modelpath = config.model_path;
+    myinfo("reading vectors from %s\n", modelpath.c_str());
+    Matrix<float> wi;
+    read_vec_bin(modelpath, wi);
+    uint32_t dim = wi.get_dim();
+    myinfo("finish reading %u vectors[dim=%u] from %s\n", wi.get_rows(), dim, modelpath.c_str());
+
+    size_t batchsize = config.nprocs * 100;
+    size_t num_reads = corpus.num_reads();
+    PBar bar("transform:", num_reads);
+    for (size_t start = 0; start < num_reads; start += batchsize)
+    {
+        size_t end = std::min(start + batchsize, num_reads);
+        std::vector<Vector<float>> embed(end - start);
+#pragma omp parallel for
+        for (size_t i = start; i < end; i++)
+        {
+            thread_local std::vector<uint32_t> kmers;
+            corpus.get(i, kmers);
+            Vector<float> vec(dim);
+            transform(kmers, wi, vec);
+            bar.tick();
+            embed[i - start] = vec;
+        }
+        for (auto &x : embed)
+        {
+            x.write_me(os);
+        }
+    }
+    bar.end();
+    myinfo("Finished transforming %ld sequences", num_reads);
+}
+
 template <typename BR>
 void run(Config &config, BR &reader, rpns::CRandProj &hash)
 {
@@ -243,25 +311,36 @@ void run(Config &config)
 {
     omp_set_num_threads(config.nprocs);
     rpns::CRandProj hash;
-    hash.load(config.hash_file);
-
-    if (true)
+    if (hash.load(config.hash_file) != 0)
+    {
+        myerror("load rp hash failed: %s", config.hash_file.c_str());
+        exit(EXIT_FAILURE);
+    }
+    if (config.hash_block != 1 && hash.compile(config.hash_block) != 0)
     {
+        myerror("failed to compile hash with hash_block=%u", config.hash_block);
+        exit(EXIT_FAILURE);
+    }
 
-        if (config.is_fasta)
-        {
-            BatchReader<FastaTextReaderBase, FastaRecord> reader(config.inputpath);
-            run(config, reader, hash);
-        }
-        else if (config.is_fastq)
+    if (!config.corpus_file.empty())
+    {
+        HashedCorpus corpus;
+        try
         {
-            BatchReader<FastqTextReaderBase, FastaRecord> reader(config.inputpath);
-            run(config, reader, hash);
+            corpus.load(config.corpus_file);
+            corpus.verify(hash.get_kmer_size(), hash.get_hash_size(), HashedCorpus::checksum_file(config.hash_file));
         }
-        else
+        catch (const std::exception &e)
         {
-            BatchReader<SeqTextReaderBase, FastaRecord> reader(config.inputpath);
-            run(config, reader, hash);
+            myerror("%s", e.what());
+            exit(EXIT_FAILURE);
         }
+        const HashedCorpus &reader = corpus;
+        run(config, reader, hash);
+    }
+    else
+    {
+        PipelinedSeqReader reader(ChunkedBatchReader(config.inputpath, config.seq_format()));
+        run(config, reader, hash);
     }
 }
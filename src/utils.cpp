@@ -18,6 +18,10 @@
 #include <algorithm>
 #include <random>
 #include <cctype>
+#include <atomic>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include <locale>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -276,15 +280,63 @@ uint32_t hash_string(const std::string &s) {
 
 	namespace myrand
 	{
-			static std::random_device rd;
-			std::mt19937 gen(rd());
-			std::uniform_real_distribution<> dis(0, 1);
+			static std::atomic<uint64_t> base_seed{std::random_device{}()};
+			static std::atomic<uint32_t> base_stream(0);
+			std::atomic<uint32_t> seed_generation(1);
 
-			void seed(uint32_t s)
+			void Xoshiro256::seed(uint64_t x)
 			{
-					gen.seed(s);
+					for (int i = 0; i < 4; i++)
+					{
+							uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+							z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+							z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+							s[i] = z ^ (z >> 31);
+					}
 			}
 
- 
+			void Xoshiro256::jump()
+			{
+					static const uint64_t JUMP[] = {0x180ec6d33cfd0abaull, 0xd5a61266f0c9392cull, 0xa9582618e03fc9aaull, 0x39abdc4529b1661cull};
+					uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+					for (int i = 0; i < 4; i++)
+					{
+							for (int b = 0; b < 64; b++)
+							{
+									if (JUMP[i] & (1ull << b))
+									{
+											s0 ^= s[0];
+											s1 ^= s[1];
+											s2 ^= s[2];
+											s3 ^= s[3];
+									}
+									(*this)();
+							}
+					}
+					s[0] = s0;
+					s[1] = s1;
+					s[2] = s2;
+					s[3] = s3;
+			}
+
+			void seed(uint64_t s, uint32_t first_stream)
+			{
+					base_seed = s;
+					base_stream = first_stream;
+					seed_generation++;
+			}
+
+			void init_thread_rng(Xoshiro256 &rng)
+			{
+					uint32_t stream = base_stream;
+#ifdef _OPENMP
+					stream += omp_get_thread_num();
+#endif
+					rng.seed(base_seed);
+					for (uint32_t i = 0; i < stream; i++)
+					{
+							rng.jump();
+					}
+			}
 	} //end namespace myrand
 }
\ No newline at end of file
@@ -14,6 +14,9 @@
 #include <algorithm>
 #include <cassert>
 #include <unordered_map>
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
 
 namespace sparc {
 
@@ -59,10 +62,109 @@ inline std::string rtrim_copy(std::string s);
 // trim from both ends (copying)
 std::string trim_copy(std::string s);
 
+namespace myrand
+{
+        /*
+         * xoshiro256** (Blackman and Vigna). Every thread draws from its own
+         * generator (see thread_rng), so there is no shared state between
+         * the OpenMP threads.
+         */
+        class Xoshiro256
+        {
+        public:
+                typedef uint64_t result_type;
+
+                static constexpr result_type min()
+                {
+                        return 0;
+                }
+                static constexpr result_type max()
+                {
+                        return UINT64_MAX;
+                }
+
+                // expand a 64 bit seed to the full state with splitmix64
+                void seed(uint64_t s);
+
+                // advance by 2^128 draws, used to give each thread a non-overlapping stream
+                void jump();
+
+                inline result_type operator()()
+                {
+                        const uint64_t result = rotl(s[1] * 5, 7) * 9;
+                        const uint64_t t = s[1] << 17;
+                        s[2] ^= s[0];
+                        s[3] ^= s[1];
+                        s[1] ^= s[2];
+                        s[0] ^= s[3];
+                        s[2] ^= t;
+                        s[3] = rotl(s[3], 45);
+                        return result;
+                }
+
+        private:
+                static inline uint64_t rotl(const uint64_t x, int k)
+                {
+                        return (x << k) | (x >> (64 - k));
+                }
+                uint64_t s[4];
+        };
+
+        /*
+         * Seed all streams. The generator of OpenMP thread t is the seeded
+         * generator jumped first_stream + t times, so a run with the same
+         * seed and thread count draws the same numbers in every thread.
+         * Without a call to seed() the seed comes from std::random_device.
+         */
+        void seed(uint64_t s, uint32_t first_stream = 0);
+
+        extern std::atomic<uint32_t> seed_generation;
+
+        // (re)initialize the calling thread's generator from the current seed
+        void init_thread_rng(Xoshiro256 &rng);
+
+        inline Xoshiro256 &thread_rng()
+        {
+                thread_local Xoshiro256 rng;
+                thread_local uint32_t generation = 0;
+                uint32_t g = seed_generation.load(std::memory_order_relaxed);
+                if (generation != g)
+                {
+                        init_thread_rng(rng);
+                        generation = g;
+                }
+                return rng;
+        }
+
+        // uniform in [0, 1)
+        template <typename T>
+        inline T uniform()
+        {
+                if constexpr (std::is_same<T, float>::value)
+                {
+                        return (thread_rng()() >> 40) * 0x1.0p-24f;
+                }
+                else
+                {
+                        return (T)((thread_rng()() >> 11) * 0x1.0p-53);
+                }
+        }
+
+        // uniform in [0, n)
+        inline uint32_t uniform_int(uint32_t n)
+        {
+                return (uint32_t)(((thread_rng()() >> 32) * n) >> 32);
+        }
+
+        template <typename T>
+        inline void shuffle(std::vector<T> &v)
+        {
+                std::shuffle(v.begin(), v.end(), thread_rng());
+        }
+}
+
 template<typename T> void shuffle(std::vector<T> &v) {
-	std::random_device rd;
-	std::default_random_engine rng(rd());
-	std::shuffle(std::begin(v), std::end(v), rng);
+	myrand::shuffle(v);
 }
 
 template<typename T> inline void split(std::vector<std::vector<T>> &results,
@@ -114,28 +216,5 @@ std::string get_ip_adderss();
 
 std::string get_ip_adderss(const std::string &hostname);
 
-namespace myrand
-{
-
-        extern std::mt19937 gen;
-
-        extern std::uniform_real_distribution<> dis;
-
-        void seed(uint32_t s);
-
-        template <typename T>
-        inline T uniform()
-        {
-                return dis(gen);
-        }
-
-        template <typename T>
-        inline void shuffle(std::vector<T> &v)
-        {
-                std::shuffle(v.begin(), v.end(), gen);
-        }
-}
-
-
 }
 #endif /* UTILS_H_ */
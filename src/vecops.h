@@ -0,0 +1,739 @@
+/*
+ * vecops.h
+ *
+ *  Dense vector kernels used by the training loop (dot, axpy, scale).
+ *  The float versions pick an AVX2 or AVX-512 implementation at run time,
+ *  other value types use the plain loops. Rows stored as bf16_t or fp16_t
+ *  have their own versions that compute in float (AVX2 + F16C when
+ *  available).
+ */
+
+#ifndef SOURCE_DIRECTORY__SRC_SPARC_VECOPS_H_
+#define SOURCE_DIRECTORY__SRC_SPARC_VECOPS_H_
+
+#include <cstdint>
+#include <type_traits>
+#include "half.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VECOPS_X86_KERNELS
+#endif
+
+namespace vecops
+{
+    enum Isa
+    {
+        ISA_SCALAR = 0,
+        ISA_AVX2 = 1,
+        ISA_AVX512 = 2
+    };
+
+    // best instruction set supported by this cpu
+    inline Isa detect_isa()
+    {
+#ifdef VECOPS_X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+        {
+            return ISA_AVX512;
+        }
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        {
+            return ISA_AVX2;
+        }
+#endif
+        return ISA_SCALAR;
+    }
+
+    // isa the float kernels dispatch to, only lower it for testing
+    inline Isa isa = detect_isa();
+
+    inline bool detect_f16c()
+    {
+#ifdef VECOPS_X86_KERNELS
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("f16c");
+#else
+        return false;
+#endif
+    }
+
+    // the 16-bit kernels need F16C besides AVX2 (for fp16_t)
+    inline bool has_f16c = detect_f16c();
+
+    /*
+     * generic versions
+     */
+
+    // x . y
+    template <typename T>
+    inline float dot(const T *x, const T *y, uint32_t n)
+    {
+        float r = 0;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            r += x[i] * y[i];
+        }
+        return r;
+    }
+
+    // y += a * x
+    template <typename T>
+    inline void axpy(float a, const T *x, T *y, uint32_t n)
+    {
+        for (uint32_t i = 0; i < n; i++)
+        {
+            y[i] += x[i] * a;
+        }
+    }
+
+    // y += x
+    template <typename T>
+    inline void add(const T *x, T *y, uint32_t n)
+    {
+        for (uint32_t i = 0; i < n; i++)
+        {
+            y[i] += x[i];
+        }
+    }
+
+    // x *= a
+    template <typename T>
+    inline void scale(float a, T *x, uint32_t n)
+    {
+        for (uint32_t i = 0; i < n; i++)
+        {
+            x[i] *= a;
+        }
+    }
+
+    /*
+     * g += a * v and then v += a * h, reading v once. This is the update
+     * of one output row in negative sampling (g is the gradient of the
+     * hidden layer, h the hidden layer).
+     */
+    template <typename T>
+    inline void axpy2(float a, T *v, const T *h, T *g, uint32_t n)
+    {
+        for (uint32_t i = 0; i < n; i++)
+        {
+            T x = v[i];
+            g[i] += x * a;
+            v[i] = x + h[i] * a;
+        }
+    }
+
+#ifdef VECOPS_X86_KERNELS
+    namespace detail
+    {
+        __attribute__((target("avx2,fma"))) inline float hsum_avx2(__m256 v)
+        {
+            __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+            s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+            s = _mm_add_ss(s, _mm_movehdup_ps(s));
+            return _mm_cvtss_f32(s);
+        }
+
+        __attribute__((target("avx2,fma"))) inline float dot_avx2(const float *x, const float *y, uint32_t n)
+        {
+            __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+            uint32_t i = 0;
+            for (; i + 16 <= n; i += 16)
+            {
+                acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), acc0);
+                acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8), acc1);
+            }
+            for (; i + 8 <= n; i += 8)
+            {
+                acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), acc0);
+            }
+            float r = hsum_avx2(_mm256_add_ps(acc0, acc1));
+            for (; i < n; i++)
+            {
+                r += x[i] * y[i];
+            }
+            return r;
+        }
+
+        __attribute__((target("avx2,fma"))) inline void axpy_avx2(float a, const float *x, float *y, uint32_t n)
+        {
+            __m256 va = _mm256_set1_ps(a);
+            uint32_t i = 0;
+            for (; i + 8 <= n; i += 8)
+            {
+                _mm256_storeu_ps(y + i, _mm256_fmadd_ps(_mm256_loadu_ps(x + i), va, _mm256_loadu_ps(y + i)));
+            }
+            for (; i < n; i++)
+            {
+                y[i] += x[i] * a;
+            }
+        }
+
+        __attribute__((target("avx2,fma"))) inline void add_avx2(const float *x, float *y, uint32_t n)
+        {
+            uint32_t i = 0;
+            for (; i + 8 <= n; i += 8)
+            {
+                _mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+            }
+            for (; i < n; i++)
+            {
+                y[i] += x[i];
+            }
+        }
+
+        __attribute__((target("avx2,fma"))) inline void scale_avx2(float a, float *x, uint32_t n)
+        {
+            __m256 va = _mm256_set1_ps(a);
+            uint32_t i = 0;
+            for (; i + 8 <= n; i += 8)
+            {
+                _mm256_storeu_ps(x + i, _mm256_mul_ps(_mm256_loadu_ps(x + i), va));
+            }
+            for (; i < n; i++)
+            {
+                x[i] *= a;
+            }
+        }
+
+        __attribute__((target("avx2,fma"))) inline void axpy2_avx2(float a, float *v, const float *h, float *g, uint32_t n)
+        {
+            __m256 va = _mm256_set1_ps(a);
+            uint32_t i = 0;
+            for (; i + 8 <= n; i += 8)
+            {
+                __m256 x = _mm256_loadu_ps(v + i);
+                _mm256_storeu_ps(g + i, _mm256_fmadd_ps(x, va, _mm256_loadu_ps(g + i)));
+                _mm256_storeu_ps(v + i, _mm256_fmadd_ps(_mm256_loadu_ps(h + i), va, x));
+            }
+            for (; i < n; i++)
+            {
+                float x = v[i];
+                g[i] += x * a;
+                v[i] = x + h[i] * a;
+            }
+        }
+
+        // the AVX-512 versions handle the tail with a masked load/store
+        __attribute__((target("avx512f"))) inline __mmask16 tail_mask(uint32_t n)
+        {
+            return (__mmask16)((1u << n) - 1);
+        }
+
+        __attribute__((target("avx512f"))) inline float hsum_avx512(__m512 v)
+        {
+            // the zero-masked extract avoids _mm512_undefined_ps (-Wuninitialized with gcc 12)
+            __m256 lo = _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd((__mmask8)0xFF, _mm512_castps_pd(v), 0));
+            __m256 hi = _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd((__mmask8)0xFF, _mm512_castps_pd(v), 1));
+            __m256 s = _mm256_add_ps(lo, hi);
+            __m128 t = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+            t = _mm_add_ps(t, _mm_movehl_ps(t, t));
+            t = _mm_add_ss(t, _mm_movehdup_ps(t));
+            return _mm_cvtss_f32(t);
+        }
+
+        __attribute__((target("avx512f"))) inline float dot_avx512(const float *x, const float *y, uint32_t n)
+        {
+            __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+            uint32_t i = 0;
+            for (; i + 32 <= n; i += 32)
+            {
+                acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), acc0);
+                acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i + 16), _mm512_loadu_ps(y + i + 16), acc1);
+            }
+            for (; i + 16 <= n; i += 16)
+            {
+                acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), acc0);
+            }
+            if (i < n)
+            {
+                __mmask16 m = tail_mask(n - i);
+                acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, x + i), _mm512_maskz_loadu_ps(m, y + i), acc1);
+            }
+            return hsum_avx512(_mm512_add_ps(acc0, acc1));
+        }
+
+        __attribute__((target("avx512f"))) inline void axpy_avx512(float a, const float *x, float *y, uint32_t n)
+        {
+            __m512 va = _mm512_set1_ps(a);
+            uint32_t i = 0;
+            for (; i + 16 <= n; i += 16)
+            {
+                _mm512_storeu_ps(y + i, _mm512_fmadd_ps(_mm512_loadu_ps(x + i), va, _mm512_loadu_ps(y + i)));
+            }
+            if (i < n)
+            {
+                __mmask16 m = tail_mask(n - i);
+                _mm512_mask_storeu_ps(y + i, m, _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, x + i), va, _mm512_maskz_loadu_ps(m, y + i)));
+            }
+        }
+
+        __attribute__((target("avx512f"))) inline void add_avx512(const float *x, float *y, uint32_t n)
+        {
+            uint32_t i = 0;
+            for (; i + 16 <= n; i += 16)
+            {
+                _mm512_storeu_ps(y + i, _mm512_add_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i)));
+            }
+            if (i < n)
+            {
+                __mmask16 m = tail_mask(n - i);
+                _mm512_mask_storeu_ps(y + i, m, _mm512_add_ps(_mm512_maskz_loadu_ps(m, x + i), _mm512_maskz_loadu_ps(m, y + i)));
+            }
+        }
+
+        __attribute__((target("avx512f"))) inline void scale_avx512(float a, float *x, uint32_t n)
+        {
+            __m512 va = _mm512_set1_ps(a);
+            uint32_t i = 0;
+            for (; i + 16 <= n; i += 16)
+            {
+                _mm512_storeu_ps(x + i, _mm512_mul_ps(_mm512_loadu_ps(x + i), va));
+            }
+            if (i < n)
+            {
+                __mmask16 m = tail_mask(n - i);
+                _mm512_mask_storeu_ps(x + i, m, _mm512_mul_ps(_mm512_maskz_loadu_ps(m, x + i), va));
+            }
+        }
+
+        __attribute__((target("avx512f"))) inline void axpy2_avx512(float a, float *v, const float *h, float *g, uint32_t n)
+        {
+            __m512 va = _mm512_set1_ps(a);
+            uint32_t i = 0;
+            for (; i + 16 <= n; i += 16)
+            {
+                __m512 x = _mm512_loadu_ps(v + i);
+                _mm512_storeu_ps(g + i, _mm512_fmadd_ps(x, va, _mm512_loadu_ps(g + i)));
+                _mm512_storeu_ps(v + i, _mm512_fmadd_ps(_mm512_loadu_ps(h + i), va, x));
+            }
+            if (i < n)
+            {
+                __mmask16 m = tail_mask(n - i);
+                __m512 x = _mm512_maskz_loadu_ps(m, v + i);
+                _mm512_mask_storeu_ps(g + i, m, _mm512_fmadd_ps(x, va, _mm512_maskz_loadu_ps(m, g + i)));
+                _mm512_mask_storeu_ps(v + i, m, _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, h + i), va, x));
+            }
+        }
+    } // namespace detail
+#endif
+
+    /*
+     * float versions with run time dispatch
+     */
+
+    inline float dot(const float *x, const float *y, uint32_t n)
+    {
+#ifdef VECOPS_X86_KERNELS
+        if (isa == ISA_AVX512)
+            return detail::dot_avx512(x, y, n);
+        if (isa == ISA_AVX2)
+            return detail::dot_avx2(x, y, n);
+#endif
+        return dot<float>(x, y, n);
+    }
+
+    inline void axpy(float a, const float *x, float *y, uint32_t n)
+    {
+#ifdef VECOPS_X86_KERNELS
+        if (isa == ISA_AVX512)
+            return detail::axpy_avx512(a, x, y, n);
+        if (isa == ISA_AVX2)
+            return detail::axpy_avx2(a, x, y, n);
+#endif
+        axpy<float>(a, x, y, n);
+    }
+
+    inline void add(const float *x, float *y, uint32_t n)
+    {
+#ifdef VECOPS_X86_KERNELS
+        if (isa == ISA_AVX512)
+            return detail::add_avx512(x, y, n);
+        if (isa == ISA_AVX2)
+            return detail::add_avx2(x, y, n);
+#endif
+        add<float>(x, y, n);
+    }
+
+    inline void scale(float a, float *x, uint32_t n)
+    {
+#ifdef VECOPS_X86_KERNELS
+        if (isa == ISA_AVX512)
+            return detail::scale_avx512(a, x, n);
+        if (isa == ISA_AVX2)
+            return detail::scale_avx2(a, x, n);
+#endif
+        scale<float>(a, x, n);
+    }
+
+    inline void axpy2(float a, float *v, const float *h, float *g, uint32_t n)
+    {
+#ifdef VECOPS_X86_KERNELS
+        if (isa == ISA_AVX512)
+            return detail::axpy2_avx512(a, v, h, g, n);
+        if (isa == ISA_AVX2)
+            return detail::axpy2_avx2(a, v, h, g, n);
+#endif
+        axpy2<float>(a, v, h, g, n);
+    }
+
+    /*
+     * 16-bit rows. The row operand is converted to float on load, the
+     * other operands and the arithmetic are float, and a row that is
+     * written is rounded back stochastically (see bf16_t).
+     */
+    template <typename S>
+    using if_half = typename std::enable_if<std::is_same<S, bf16_t>::value || std::is_same<S, fp16_t>::value>::type;
+
+    namespace detail
+    {
+        template <typename S>
+        inline float dot_half(const S *x, const float *y, uint32_t n)
+        {
+            float r = 0;
+            for (uint32_t i = 0; i < n; i++)
+            {
+                r += S::to_float(x[i].bits) * y[i];
+            }
+            return r;
+        }
+
+        template <typename S>
+        inline void add_half(const S *x, float *y, uint32_t n)
+        {
+            for (uint32_t i = 0; i < n; i++)
+            {
+                y[i] += S::to_float(x[i].bits);
+            }
+        }
+
+        template <typename S>
+        inline void axpy_half(float a, const float *x, S *y, uint32_t n)
+        {
+            for (uint32_t i = 0; i < n; i++)
+            {
+                y[i].bits = S::from_float(S::to_float(y[i].bits) + x[i] * a, halfops::rounding_bits());
+            }
+        }
+
+        template <typename S>
+        inline void axpy2_half(float a, S *v, const float *h, float *g, uint32_t n)
+        {
+            for (uint32_t i = 0; i < n; i++)
+            {
+                float x = S::to_float(v[i].bits);
+                g[i] += x * a;
+                v[i].bits = S::from_float(x + h[i] * a, halfops::rounding_bits());
+            }
+        }
+
+#ifdef VECOPS_X86_KERNELS
+#define VECOPS_HALF_TARGET __attribute__((target("avx2,fma,f16c")))
+
+        VECOPS_HALF_TARGET inline __m256 load_half(const bf16_t *p)
+        {
+            __m256i u = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)p));
+            return _mm256_castsi256_ps(_mm256_slli_epi32(u, 16));
+        }
+
+        VECOPS_HALF_TARGET inline __m256 load_half(const fp16_t *p)
+        {
+            return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)p));
+        }
+
+        /*
+         * Random bits for stochastic rounding, of which the upper 16 are
+         * used. The state (a xorshift32 per lane) advances once per call,
+         * the bits for the i-th vector of a row are the state plus i times
+         * an odd constant, mixed with a multiply. That is two instructions
+         * per vector, and the vectors of a row do not wait for each other.
+         */
+        VECOPS_HALF_TARGET inline __m256i next_rounding_state(__m256i &s)
+        {
+            s = _mm256_xor_si256(s, _mm256_slli_epi32(s, 13));
+            s = _mm256_xor_si256(s, _mm256_srli_epi32(s, 17));
+            s = _mm256_xor_si256(s, _mm256_slli_epi32(s, 5));
+            return s;
+        }
+
+        VECOPS_HALF_TARGET inline __m256i rounding_bits(__m256i s, uint32_t i)
+        {
+            __m256i x = _mm256_add_epi32(s, _mm256_set1_epi32(i * 0x9e3779b9u));
+            return _mm256_mullo_epi32(x, _mm256_set1_epi32(0x7feb352d));
+        }
+
+        // per thread state of next_rounding_state, 8 lanes for AVX2 and 16 for AVX-512
+        inline uint32_t *rounding_state()
+        {
+            alignas(64) thread_local uint32_t s[16] = {0};
+            if (s[0] == 0)
+            {
+                for (int i = 0; i < 16; i++)
+                {
+                    s[i] = halfops::rounding_bits() | 1;
+                }
+            }
+            return s;
+        }
+
+        // adds 16 random bits below the ones kept, then truncates
+        VECOPS_HALF_TARGET inline void store_half(bf16_t *p, __m256 x, __m256i r)
+        {
+            __m256i u = _mm256_castps_si256(x);
+            __m256i abs = _mm256_and_si256(u, _mm256_set1_epi32(0x7fffffff));
+            __m256i finite = _mm256_cmpgt_epi32(_mm256_set1_epi32(0x7f7f0000), abs);
+            r = _mm256_and_si256(_mm256_srli_epi32(r, 16), finite);
+            u = _mm256_srli_epi32(_mm256_add_epi32(u, r), 16);
+            u = _mm256_permute4x64_epi64(_mm256_packus_epi32(u, u), 0x08);
+            _mm_storeu_si128((__m128i *)p, _mm256_castsi256_si128(u));
+        }
+
+        /*
+         * adds a random fraction of the fp16 ulp of x to its magnitude and
+         * converts toward zero, which also covers the fp16 subnormals.
+         * Values beyond the fp16 range saturate like in fp16_t.
+         */
+        VECOPS_HALF_TARGET inline void store_half(fp16_t *p, __m256 x, __m256i r)
+        {
+            __m256i u = _mm256_castps_si256(x);
+            __m256i abs = _mm256_and_si256(u, _mm256_set1_epi32(0x7fffffff));
+            __m256i e = _mm256_max_epi32(_mm256_and_si256(abs, _mm256_set1_epi32(0x7f800000)), _mm256_set1_epi32((127 - 14) << 23));
+            __m256 ulp = _mm256_castsi256_ps(_mm256_sub_epi32(e, _mm256_set1_epi32(10 << 23)));
+            __m256 frac = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(r, 8)), _mm256_set1_ps(0x1.0p-24f));
+            __m256 step = _mm256_castsi256_ps(_mm256_or_si256(_mm256_castps_si256(_mm256_mul_ps(frac, ulp)),
+                                                              _mm256_and_si256(u, _mm256_set1_epi32(0x80000000))));
+            __m256i in_range = _mm256_cmpgt_epi32(_mm256_set1_epi32(0x477fe000), abs);
+            step = _mm256_and_ps(step, _mm256_castsi256_ps(in_range));
+            _mm_storeu_si128((__m128i *)p, _mm256_cvtps_ph(_mm256_add_ps(x, step), _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC));
+        }
+
+        template <typename S>
+        VECOPS_HALF_TARGET inline float dot_half_avx2(const S *x, const float *y, uint32_t n)
+        {
+            __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+            uint32_t i = 0;
+            for (; i + 16 <= n; i += 16)
+            {
+                acc0 = _mm256_fmadd_ps(load_half(x + i), _mm256_loadu_ps(y + i), acc0);
+                acc1 = _mm256_fmadd_ps(load_half(x + i + 8), _mm256_loadu_ps(y + i + 8), acc1);
+            }
+            for (; i + 8 <= n; i += 8)
+            {
+                acc0 = _mm256_fmadd_ps(load_half(x + i), _mm256_loadu_ps(y + i), acc0);
+            }
+            return hsum_avx2(_mm256_add_ps(acc0, acc1)) + dot_half(x + i, y + i, n - i);
+        }
+
+        template <typename S>
+        VECOPS_HALF_TARGET inline void add_half_avx2(const S *x, float *y, uint32_t n)
+        {
+            uint32_t i = 0;
+            for (; i + 8 <= n; i += 8)
+            {
+                _mm256_storeu_ps(y + i, _mm256_add_ps(load_half(x + i), _mm256_loadu_ps(y + i)));
+            }
+            add_half(x + i, y + i, n - i);
+        }
+
+        template <typename S>
+        VECOPS_HALF_TARGET inline void axpy_half_avx2(float a, const float *x, S *y, uint32_t n)
+        {
+            __m256i *state = (__m256i *)rounding_state();
+            __m256i s = next_rounding_state(*state);
+            __m256 va = _mm256_set1_ps(a);
+            uint32_t i = 0;
+            for (; i + 8 <= n; i += 8)
+            {
+                __m256 r = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), va, load_half(y + i));
+                store_half(y + i, r, rounding_bits(s, i));
+            }
+            axpy_half(a, x + i, y + i, n - i);
+        }
+
+        template <typename S>
+        VECOPS_HALF_TARGET inline void axpy2_half_avx2(float a, S *v, const float *h, float *g, uint32_t n)
+        {
+            __m256i *state = (__m256i *)rounding_state();
+            __m256i s = next_rounding_state(*state);
+            __m256 va = _mm256_set1_ps(a);
+            uint32_t i = 0;
+            for (; i + 8 <= n; i += 8)
+            {
+                __m256 x = load_half(v + i);
+                _mm256_storeu_ps(g + i, _mm256_fmadd_ps(x, va, _mm256_loadu_ps(g + i)));
+                store_half(v + i, _mm256_fmadd_ps(_mm256_loadu_ps(h + i), va, x), rounding_bits(s, i));
+            }
+            axpy2_half(a, v + i, h + i, g + i, n - i);
+        }
+
+#undef VECOPS_HALF_TARGET
+
+        // the same with 16 lanes, the rest of a row is left to the AVX2 versions
+#define VECOPS_HALF_TARGET __attribute__((target("avx512f,avx2,fma,f16c")))
+
+        // the zero-masked forms, with every lane set, avoid _mm512_undefined_*
+        // (-Wuninitialized with gcc 12), like hsum_avx512
+        static constexpr __mmask16 ALL16 = 0xFFFF;
+
+        VECOPS_HALF_TARGET inline __m512 load_half16(const bf16_t *p)
+        {
+            __m512i u = _mm512_maskz_cvtepu16_epi32(ALL16, _mm256_loadu_si256((const __m256i *)p));
+            return _mm512_castsi512_ps(_mm512_maskz_slli_epi32(ALL16, u, 16));
+        }
+
+        VECOPS_HALF_TARGET inline __m512 load_half16(const fp16_t *p)
+        {
+            return _mm512_maskz_cvtph_ps(ALL16, _mm256_loadu_si256((const __m256i *)p));
+        }
+
+        VECOPS_HALF_TARGET inline __m512i next_rounding_state(__m512i &s)
+        {
+            s = _mm512_xor_si512(s, _mm512_maskz_slli_epi32(ALL16, s, 13));
+            s = _mm512_xor_si512(s, _mm512_maskz_srli_epi32(ALL16, s, 17));
+            s = _mm512_xor_si512(s, _mm512_maskz_slli_epi32(ALL16, s, 5));
+            return s;
+        }
+
+        VECOPS_HALF_TARGET inline __m512i rounding_bits(__m512i s, uint32_t i)
+        {
+            __m512i x = _mm512_add_epi32(s, _mm512_set1_epi32(i * 0x9e3779b9u));
+            return _mm512_mullo_epi32(x, _mm512_set1_epi32(0x7feb352d));
+        }
+
+        VECOPS_HALF_TARGET inline void store_half16(bf16_t *p, __m512 x, __m512i r)
+        {
+            __m512i u = _mm512_castps_si512(x);
+            __m512i abs = _mm512_and_si512(u, _mm512_set1_epi32(0x7fffffff));
+            __mmask16 finite = _mm512_cmplt_epu32_mask(abs, _mm512_set1_epi32(0x7f7f0000));
+            r = _mm512_maskz_srli_epi32(finite, r, 16);
+            u = _mm512_maskz_srli_epi32(ALL16, _mm512_add_epi32(u, r), 16);
+            _mm256_storeu_si256((__m256i *)p, _mm512_maskz_cvtepi32_epi16(ALL16, u));
+        }
+
+        VECOPS_HALF_TARGET inline void store_half16(fp16_t *p, __m512 x, __m512i r)
+        {
+            __m512i u = _mm512_castps_si512(x);
+            __m512i abs = _mm512_and_si512(u, _mm512_set1_epi32(0x7fffffff));
+            __m512i e = _mm512_maskz_max_epi32(ALL16, _mm512_and_si512(abs, _mm512_set1_epi32(0x7f800000)), _mm512_set1_epi32((127 - 14) << 23));
+            __m512 ulp = _mm512_castsi512_ps(_mm512_sub_epi32(e, _mm512_set1_epi32(10 << 23)));
+            __m512 frac = _mm512_mul_ps(_mm512_maskz_cvtepi32_ps(ALL16, _mm512_maskz_srli_epi32(ALL16, r, 8)), _mm512_set1_ps(0x1.0p-24f));
+            __m512i step = _mm512_or_si512(_mm512_castps_si512(_mm512_mul_ps(frac, ulp)),
+                                           _mm512_and_si512(u, _mm512_set1_epi32(0x80000000)));
+            __mmask16 in_range = _mm512_cmplt_epu32_mask(abs, _mm512_set1_epi32(0x477fe000));
+            __m512 y = _mm512_mask_add_ps(x, in_range, x, _mm512_castsi512_ps(step));
+            _mm256_storeu_si256((__m256i *)p, _mm512_maskz_cvtps_ph(ALL16, y, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC));
+        }
+
+        template <typename S>
+        VECOPS_HALF_TARGET inline float dot_half_avx512(const S *x, const float *y, uint32_t n)
+        {
+            __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+            uint32_t i = 0;
+            for (; i + 32 <= n; i += 32)
+            {
+                acc0 = _mm512_fmadd_ps(load_half16(x + i), _mm512_loadu_ps(y + i), acc0);
+                acc1 = _mm512_fmadd_ps(load_half16(x + i + 16), _mm512_loadu_ps(y + i + 16), acc1);
+            }
+            for (; i + 16 <= n; i += 16)
+            {
+                acc0 = _mm512_fmadd_ps(load_half16(x + i), _mm512_loadu_ps(y + i), acc0);
+            }
+            return hsum_avx512(_mm512_add_ps(acc0, acc1)) + dot_half_avx2(x + i, y + i, n - i);
+        }
+
+        template <typename S>
+        VECOPS_HALF_TARGET inline void add_half_avx512(const S *x, float *y, uint32_t n)
+        {
+            uint32_t i = 0;
+            for (; i + 16 <= n; i += 16)
+            {
+                _mm512_storeu_ps(y + i, _mm512_add_ps(load_half16(x + i), _mm512_loadu_ps(y + i)));
+            }
+            add_half_avx2(x + i, y + i, n - i);
+        }
+
+        template <typename S>
+        VECOPS_HALF_TARGET inline void axpy_half_avx512(float a, const float *x, S *y, uint32_t n)
+        {
+            __m512i *state = (__m512i *)rounding_state();
+            __m512i s = next_rounding_state(*state);
+            __m512 va = _mm512_set1_ps(a);
+            uint32_t i = 0;
+            for (; i + 16 <= n; i += 16)
+            {
+                __m512 r = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), va, load_half16(y + i));
+                store_half16(y + i, r, rounding_bits(s, i));
+            }
+            axpy_half_avx2(a, x + i, y + i, n - i);
+        }
+
+        template <typename S>
+        VECOPS_HALF_TARGET inline void axpy2_half_avx512(float a, S *v, const float *h, float *g, uint32_t n)
+        {
+            __m512i *state = (__m512i *)rounding_state();
+            __m512i s = next_rounding_state(*state);
+            __m512 va = _mm512_set1_ps(a);
+            uint32_t i = 0;
+            for (; i + 16 <= n; i += 16)
+            {
+                __m512 x = load_half16(v + i);
+                _mm512_storeu_ps(g + i, _mm512_fmadd_ps(x, va, _mm512_loadu_ps(g + i)));
+                store_half16(v + i, _mm512_fmadd_ps(_mm512_loadu_ps(h + i), va, x), rounding_bits(s, i));
+            }
+            axpy2_half_avx2(a, v + i, h + i, g + i, n - i);
+        }
+
+#undef VECOPS_HALF_TARGET
+#endif
+    } // namespace detail
+
+    template <typename S, typename = if_half<S>>
+    inline float dot(const S *x, const float *y, uint32_t n)
+    {
+#ifdef VECOPS_X86_KERNELS
+        if (isa == ISA_AVX512 && has_f16c)
+            return detail::dot_half_avx512(x, y, n);
+        if (isa != ISA_SCALAR && has_f16c)
+            return detail::dot_half_avx2(x, y, n);
+#endif
+        return detail::dot_half(x, y, n);
+    }
+
+    template <typename S, typename = if_half<S>>
+    inline void add(const S *x, float *y, uint32_t n)
+    {
+#ifdef VECOPS_X86_KERNELS
+        if (isa == ISA_AVX512 && has_f16c)
+            return detail::add_half_avx512(x, y, n);
+        if (isa != ISA_SCALAR && has_f16c)
+            return detail::add_half_avx2(x, y, n);
+#endif
+        detail::add_half(x, y, n);
+    }
+
+    template <typename S, typename = if_half<S>>
+    inline void axpy(float a, const float *x, S *y, uint32_t n)
+    {
+#ifdef VECOPS_X86_KERNELS
+        if (isa == ISA_AVX512 && has_f16c)
+            return detail::axpy_half_avx512(a, x, y, n);
+        if (isa != ISA_SCALAR && has_f16c)
+            return detail::axpy_half_avx2(a, x, y, n);
+#endif
+        detail::axpy_half(a, x, y, n);
+    }
+
+    template <typename S, typename = if_half<S>>
+    inline void axpy2(float a, S *v, const float *h, float *g, uint32_t n)
+    {
+#ifdef VECOPS_X86_KERNELS
+        if (isa == ISA_AVX512 && has_f16c)
+            return detail::axpy2_half_avx512(a, v, h, g, n);
+        if (isa != ISA_SCALAR && has_f16c)
+            return detail::axpy2_half_avx2(a, v, h, g, n);
+#endif
+        detail::axpy2_half(a, v, h, g, n);
+    }
+} // namespace vecops
+
+#endif /* SOURCE_DIRECTORY__SRC_SPARC_VECOPS_H_ */